@@ -9,6 +9,12 @@ import matplotlib.pyplot as plt
 import numpy as np
 import io
 
+# Implementations in the order they are plotted
+IMPLEMENTATIONS = ['SharedPtr', 'ManagedEntity', 'MarkSweep']
+
+# Percentiles reported by the latency benchmarks, as counter suffixes
+LATENCY_PERCENTILES = ['p50', 'p99', 'p99.9', 'max']
+
 def parse_benchmark_json(json_data):
     results = defaultdict(dict)
     
@@ -41,6 +47,30 @@ def parse_benchmark_json(json_data):
     
     return results
 
+def parse_latency_json(json_data):
+    """Collect the tick and visit percentiles of the latency benchmarks"""
+    latency = defaultdict(dict)
+    
+    data = json.loads(json_data)
+    
+    for benchmark in data['benchmarks']:
+        name = benchmark['name']
+        match = re.match(r'BM_(\w+)Latency/(\d+)/(\d+)/iterations:\d+/real_time', name)
+        
+        if not match:
+            continue
+            
+        simulation_type, depth, ticks = match.groups()
+        key = f"{depth}/{ticks}"
+        
+        latency[key][simulation_type] = {
+            kind: [benchmark.get(f'{kind.capitalize()}_{suffix}_us', 0)
+                   for suffix in LATENCY_PERCENTILES]
+            for kind in ('tick', 'visit')
+        }
+    
+    return latency
+
 def format_value(value):
     """Format numeric values with k or M suffix based on size"""
     if value >= 1000000:
@@ -75,9 +105,17 @@ def calculate_percent_change(old_value, new_value):
     return f"+{percent_change:.2f}%" if percent_change > 0 else f"{percent_change:.2f}%"
 
 def generate_markdown_table(results):
+    # Each metric gets a column per implementation, then the change of
+    # ManagedEntity and MarkSweep against SharedPtr
+    metrics = [('Tick/s', 'tick_rate'), ('Visit/s', 'visit_rate'), ('Objects/s', 'objects_created')]
+    
     # Table header
-    table = "| Depth/Ticks | Tick/s (SharedPtr) | Tick/s (ManagedEntity) | %-Change (Tick/s) | Visit/s (SharedPtr) | Visit/s (ManagedEntity) | %-Change (Visit/s) | Objects/s (SharedPtr) | Objects/s (ManagedEntity) | %-Change (Objects/s) |\n"
-    table += "|-------------|--------------------|-----------------------|-------------------|---------------------|-------------------------|--------------------|----------------------|--------------------------|----------------------|"
+    header = ["Depth/Ticks"]
+    for label, _ in metrics:
+        header += [f"{label} ({impl})" for impl in IMPLEMENTATIONS]
+        header += [f"%-Change ({label}, ManagedEntity)", f"%-Change ({label}, MarkSweep)"]
+    table = "| " + " | ".join(header) + " |\n"
+    table += "|" + "|".join("-" * (len(column) + 2) for column in header) + "|"
     
     # Sort keys to ensure consistent ordering
     # First by depth, then by ticks
@@ -90,22 +128,24 @@ def generate_markdown_table(results):
     for key in sorted_keys:
         if 'SharedPtr' not in results[key] or 'ManagedEntity' not in results[key]:
             continue
-            
-        shared_ptr = results[key]['SharedPtr']
-        managed_entity = results[key]['ManagedEntity']
         
-        # Calculate percentage changes
-        tick_rate_change = calculate_percent_change(shared_ptr['tick_rate'], managed_entity['tick_rate'])
-        visit_rate_change = calculate_percent_change(shared_ptr['visit_rate'], managed_entity['visit_rate'])
-        objects_created_change = calculate_percent_change(shared_ptr['objects_created'], managed_entity['objects_created'])
+        shared_ptr = results[key]['SharedPtr']
+        row = [key]
+        for _, metric in metrics:
+            # MarkSweep is left out of runs filtered to the other two
+            row += [results[key][impl][f'{metric}_formatted'] if impl in results[key] else "N/A"
+                    for impl in IMPLEMENTATIONS]
+            row += [calculate_percent_change(shared_ptr[metric], results[key][impl][metric])
+                    if impl in results[key] else "N/A"
+                    for impl in ('ManagedEntity', 'MarkSweep')]
         
         # Add row to table
-        table += f"\n| {key} | {shared_ptr['tick_rate_formatted']} | {managed_entity['tick_rate_formatted']} | {tick_rate_change} | {shared_ptr['visit_rate_formatted']} | {managed_entity['visit_rate_formatted']} | {visit_rate_change} | {shared_ptr['objects_created_formatted']} | {managed_entity['objects_created_formatted']} | {objects_created_change} |"
+        table += "\n| " + " | ".join(row) + " |"
     
     return table
 
 def generate_bar_chart(results, metric, title, output_file):
-    """Generate a bar chart comparing SharedPtr vs ManagedEntity for a specific metric"""
+    """Generate a bar chart comparing the implementations for a specific metric"""
     # Sort keys to ensure consistent ordering
     def sort_key(k):
         depth, ticks = map(int, k.split('/'))
@@ -117,22 +157,26 @@ def generate_bar_chart(results, metric, title, output_file):
     if not valid_keys:
         return None
     
+    # Plot every implementation that ran for all configurations
+    implementations = [impl for impl in IMPLEMENTATIONS
+                       if all(impl in results[k] for k in valid_keys)]
+    
     # Set up the plot
     fig, ax = plt.subplots(figsize=(12, 6))
     
     # Set width of bars
-    bar_width = 0.35
+    bar_width = 0.8 / len(implementations)
     
     # Set position of bars on x axis
     indices = np.arange(len(valid_keys))
     
-    # Create bars
-    shared_ptr_values = [results[k]['SharedPtr'][metric] for k in valid_keys]
-    managed_entity_values = [results[k]['ManagedEntity'][metric] for k in valid_keys]
-    
-    # Create bars
-    ax.bar(indices - bar_width/2, shared_ptr_values, bar_width, label='SharedPtr')
-    ax.bar(indices + bar_width/2, managed_entity_values, bar_width, label='ManagedEntity')
+    # Create bars, showing values on top of them
+    for n, impl in enumerate(implementations):
+        offset = (n - (len(implementations) - 1) / 2) * bar_width
+        values = [results[k][impl][metric] for k in valid_keys]
+        ax.bar(indices + offset, values, bar_width, label=impl)
+        for i, v in enumerate(values):
+            ax.text(i + offset, v * 1.02, format_value(v), ha='center')
     
     # Add labels, title and axis ticks
     ax.set_xlabel('Configuration (Depth/Ticks)')
@@ -144,13 +188,6 @@ def generate_bar_chart(results, metric, title, output_file):
     # Add a legend
     ax.legend()
     
-    # Show values on top of bars
-    for i, v in enumerate(shared_ptr_values):
-        ax.text(i - bar_width/2, v * 1.02, format_value(v), ha='center')
-    
-    for i, v in enumerate(managed_entity_values):
-        ax.text(i + bar_width/2, v * 1.02, format_value(v), ha='center')
-    
     # Format y-axis with K and M suffixes
     ax.get_yaxis().set_major_formatter(
         plt.FuncFormatter(lambda x, p: format_value(x).replace('k', 'K'))
@@ -165,6 +202,38 @@ def generate_bar_chart(results, metric, title, output_file):
     
     return output_file
 
+def generate_latency_chart(latency, kind, title, output_file):
+    """Plot the latency distribution of every implementation, one panel per configuration"""
+    def sort_key(k):
+        depth, ticks = map(int, k.split('/'))
+        return (depth, ticks)
+    
+    keys = sorted(latency.keys(), key=sort_key)
+    if not keys:
+        return None
+    
+    fig, axes = plt.subplots(1, len(keys), figsize=(4 * len(keys), 5), sharey=True, squeeze=False)
+    
+    for ax, key in zip(axes[0], keys):
+        for impl in IMPLEMENTATIONS:
+            if impl not in latency[key]:
+                continue
+            ax.plot(LATENCY_PERCENTILES, latency[key][impl][kind], marker='o', label=impl)
+        ax.set_title(f"Depth/Ticks {key}")
+        ax.set_xlabel('Percentile')
+        ax.set_yscale('log')
+        ax.grid(True, which='both', axis='y', alpha=0.3)
+    
+    axes[0][0].set_ylabel('Latency (us)')
+    axes[0][0].legend()
+    fig.suptitle(title)
+    
+    plt.tight_layout()
+    plt.savefig(output_file, format='svg')
+    plt.close(fig)
+    
+    return output_file
+
 def update_readme(readme_path, table, chart_paths):
     """Update README.md with the new table and charts"""
     # Check if README.md exists
@@ -203,6 +272,14 @@ def update_readme(readme_path, table, chart_paths):
     charts_section += "### Object Creation Rate Comparison\n\n"
     charts_section += f"![Object Creation Rate Comparison](charts/{os.path.basename(chart_paths['objects_created'])})\n\n"
     
+    if chart_paths.get('tick_latency'):
+        charts_section += "### Tick Latency Distribution\n\n"
+        charts_section += f"![Tick Latency Distribution](charts/{os.path.basename(chart_paths['tick_latency'])})\n\n"
+    
+    if chart_paths.get('visit_latency'):
+        charts_section += "### Visit Latency Distribution\n\n"
+        charts_section += f"![Visit Latency Distribution](charts/{os.path.basename(chart_paths['visit_latency'])})\n\n"
+    
     # Check if charts section already exists
     charts_pattern = r'## Benchmark Charts\s*\n\s*'
     charts_section_match = re.search(charts_pattern, updated_content)
@@ -236,6 +313,7 @@ def main():
         json_data = sys.stdin.read()
     
     results = parse_benchmark_json(json_data)
+    latency = parse_latency_json(json_data)
     markdown_table = generate_markdown_table(results)
     
     # Print table to stdout
@@ -263,6 +341,14 @@ def main():
     generate_bar_chart(results, 'visit_rate', 'Visit Rate Comparison (ops/sec)', chart_paths['visit_rate'])
     generate_bar_chart(results, 'objects_created', 'Object Creation Rate Comparison (ops/sec)', chart_paths['objects_created'])
     
+    # Latency charts only when the latency benchmarks were run
+    chart_paths['tick_latency'] = generate_latency_chart(
+        latency, 'tick', 'Tick Latency Distribution',
+        os.path.join(charts_dir, 'tick_latency_comparison.svg'))
+    chart_paths['visit_latency'] = generate_latency_chart(
+        latency, 'visit', 'Visit Latency Distribution',
+        os.path.join(charts_dir, 'visit_latency_comparison.svg'))
+    
     # Update README with new table and charts
     update_readme(readme_path, markdown_table, chart_paths)
 
@@ -1,5 +1,10 @@
 #include <benchmark/benchmark.h>
 #include <cpioo/managed_entity.hpp>
+#include <cpioo/mark_sweep_storage.hpp>
+#include <cpioo/frame_channel.hpp>
+#include <cpioo/tree_walker.hpp>
+#include "latency_histogram.hpp"
+#include "thread_counters.hpp"
 #include <vector>
 #include <memory>
 #include <random>
@@ -7,6 +12,8 @@
 #include <numeric>
 #include <atomic>
 #include <mutex>
+#include <string>
+#include <iostream>
 
 // Maximum age before wrapping back to 0
 const size_t MAX_AGE = 100;
@@ -26,9 +33,36 @@ struct TestObjectManaged {
   TestObjectManaged(size_t birth_tick, 
                   std::optional<testobj_ref> child_1, 
                   std::optional<testobj_ref> child_2)
-      : birth_tick(birth_tick), children{child_1, child_2} {}
+      : birth_tick(birth_tick), children{std::move(child_1), std::move(child_2)} {}
 };
 
+// Forward declaration for TestObjectTraced for use in storage type
+struct TestObjectTraced;
+
+// Same tree, reclaimed by mark-sweep instead of reference counting
+using tracedobj_storage = cpioo::managed_entity::mark_sweep_storage<TestObjectTraced, 32 - 6, int>;
+using tracedobj_ref = cpioo::managed_entity::reference<tracedobj_storage>;
+
+// Test object using a traced storage for references
+struct TestObjectTraced {
+  size_t birth_tick;
+  std::array<std::optional<tracedobj_ref>, 2> children;
+  
+  TestObjectTraced(size_t birth_tick, 
+                   std::optional<tracedobj_ref> child_1, 
+                   std::optional<tracedobj_ref> child_2)
+      : birth_tick(birth_tick), children{std::move(child_1), std::move(child_2)} {}
+};
+
+template <class F>
+void trace_references(const TestObjectTraced& node, F&& mark) {
+  mark(node.children[0]);
+  mark(node.children[1]);
+}
+
+// Ticks between two collections of the traced storage
+const size_t MARK_SWEEP_INTERVAL = 64;
+
 // Test object using shared_ptr for references
 struct TestObjectSharedPtr {
   size_t birth_tick; // Changed from age to birth_tick
@@ -37,7 +71,7 @@ struct TestObjectSharedPtr {
   TestObjectSharedPtr(size_t birth_tick, 
                      std::optional<std::shared_ptr<const TestObjectSharedPtr>> child_1, 
                      std::optional<std::shared_ptr<const TestObjectSharedPtr>> child_2)
-      : birth_tick(birth_tick), children{child_1, child_2} {}
+      : birth_tick(birth_tick), children{std::move(child_1), std::move(child_2)} {}
 };
 
 // Create a deeply nested tree using shared_ptr
@@ -57,7 +91,8 @@ createSharedPtrTree(size_t depth, size_t& current_age) {
 }
 
 // Create a deeply nested tree using ManagedEntity
-std::optional<testobj_ref> 
+template <class STORAGE>
+std::optional<typename STORAGE::ref_type> 
 createManagedEntityTree(size_t depth, size_t& current_age) {
     if (depth == 0) {
         return std::nullopt;
@@ -66,10 +101,10 @@ createManagedEntityTree(size_t depth, size_t& current_age) {
     current_age = (current_age + 1) % MAX_AGE;
     
     // First create children
-    auto left_child = createManagedEntityTree(depth - 1, current_age);
-    auto right_child = createManagedEntityTree(depth - 1, current_age);
+    auto left_child = createManagedEntityTree<STORAGE>(depth - 1, current_age);
+    auto right_child = createManagedEntityTree<STORAGE>(depth - 1, current_age);
     
-        return testobj_storage::make_entity({ current_age, left_child, right_child });
+        return STORAGE::make_entity(current_age, std::move(left_child), std::move(right_child));
 }
 
 // Simulate one tick using shared_ptr implementation
@@ -104,8 +139,9 @@ simulateSharedPtrTick(std::optional<std::shared_ptr<const TestObjectSharedPtr>>
 }
 
 // Simulate one tick using ManagedEntity implementation
-std::optional<testobj_ref> 
-simulateManagedEntityTick(std::optional<testobj_ref> node, size_t current_tick, size_t& objects_created) {
+template <class STORAGE>
+std::optional<typename STORAGE::ref_type> 
+simulateManagedEntityTick(std::optional<typename STORAGE::ref_type> node, size_t current_tick, size_t& objects_created) {
     if (!node) {
         return std::nullopt;
     }
@@ -114,8 +150,8 @@ simulateManagedEntityTick(std::optional<testobj_ref> node, size_t current_tick,
     size_t age = (current_tick - node.value()->birth_tick) % MAX_AGE;
     
     // Process children
-    auto new_left = simulateManagedEntityTick(node.value()->children[0], current_tick, objects_created);
-    auto new_right = simulateManagedEntityTick(node.value()->children[1], current_tick, objects_created);
+    auto new_left = simulateManagedEntityTick<STORAGE>(node.value()->children[0], current_tick, objects_created);
+    auto new_right = simulateManagedEntityTick<STORAGE>(node.value()->children[1], current_tick, objects_created);
         
     bool needs_replacement = (age >= MAX_AGE - 1); // Replace if at max age
     
@@ -127,7 +163,15 @@ simulateManagedEntityTick(std::optional<testobj_ref> node, size_t current_tick,
         // Create a new object with the current tick as birth_tick if the object reached max age
         size_t new_birth_tick = needs_replacement ? current_tick : node.value()->birth_tick;
         objects_created++; // Increment the passed counter instead of the thread_local
-        return testobj_storage::make_entity({new_birth_tick, new_left, new_right});
+        if constexpr (requires { typename STORAGE::locality_hint; }) {
+            // Keep the replacement next to the node it replaces, so the
+            // tree stays packed as it churns.
+            return STORAGE::make_entity(
+              STORAGE::locality_hint::near(node.value()),
+              new_birth_tick, std::move(new_left), std::move(new_right));
+        } else {
+            return STORAGE::make_entity(new_birth_tick, std::move(new_left), std::move(new_right));
+        }
     }
 
     // No changes needed, return the same object
@@ -146,62 +190,181 @@ void visitSharedPtrTreeNode(std::optional<std::shared_ptr<const TestObjectShared
     visitSharedPtrTreeNode(node.value()->children[1]);
 }
 
-void visitManagedEntityTreeNode(std::optional<testobj_ref> const& node) {
-        if (!node) return;
-    
-    observable = node.value()->birth_tick;
-    // Visit children
-    visitManagedEntityTreeNode(node.value()->children[0]);
-    visitManagedEntityTreeNode(node.value()->children[1]);
+template <class STORAGE>
+void visitManagedEntityTreeNode(typename STORAGE::ref_type const& root) {
+    // Iterative, prefetching walk; one worklist per consumer thread.
+    thread_local cpioo::managed_entity::tree_walker<STORAGE> walker;
+    walker.walk(root,
+                [](const typename STORAGE::type& node, auto& frontier) {
+                  frontier.push(node.children[0]);
+                  frontier.push(node.children[1]);
+                },
+                [](const typename STORAGE::type& node) {
+                  observable = node.birth_tick;
+                });
 }
 
-// Benchmark for shared_ptr implementation
-static void BM_SharedPtrSimulation(benchmark::State& state) {
+// Report latency percentiles of one histogram, in microseconds
+void reportLatency(benchmark::State& state, const std::string& prefix,
+                   const LatencyHistogram& histogram) {
+  state.counters[prefix + "_p50_us"] = histogram.value_at_percentile(50.0) / 1000.0;
+  state.counters[prefix + "_p99_us"] = histogram.value_at_percentile(99.0) / 1000.0;
+  state.counters[prefix + "_p99.9_us"] = histogram.value_at_percentile(99.9) / 1000.0;
+  state.counters[prefix + "_max_us"] = histogram.max() / 1000.0;
+}
+
+// Report what one thread did to the memory system, per unit of its
+// work (per tick for the producer, per visit for the consumer).
+void reportThreadCounters(benchmark::State& state, const std::string& prefix,
+                          const std::string& per, const ThreadCounterValues& values,
+                          size_t work) {
+  double n = work == 0 ? 1.0 : double(work);
+  state.counters[prefix + "_MinorFaults_per_" + per] = values.minor_faults / n;
+  state.counters[prefix + "_MajorFaults_per_" + per] = values.major_faults / n;
+  if (!values.cache_misses && !values.llc_misses && !values.dtlb_misses) {
+    static bool warned = false;
+    if (!warned) {
+      std::cerr << "perf events unavailable, reporting page faults only" << std::endl;
+      warned = true;
+    }
+    return;
+  }
+  if (values.cache_misses) {
+    state.counters[prefix + "_CacheMisses_per_" + per] = *values.cache_misses / n;
+  }
+  if (values.llc_misses) {
+    state.counters[prefix + "_LLCMisses_per_" + per] = *values.llc_misses / n;
+  }
+  if (values.dtlb_misses) {
+    state.counters[prefix + "_dTLBMisses_per_" + per] = *values.dtlb_misses / n;
+  }
+}
+
+// Page faults and cache misses of the producer and consumer threads,
+// reported by the BM_*Counters benchmarks only. The events are opened
+// outside the timed region: the producer's once, on the benchmark
+// thread, and the consumer's by each iteration's consumer thread,
+// which the timer waits for before resuming.
+template <bool COUNTERS>
+class SimulationCounters {
+  ThreadCounters d_producer_events;
+  std::optional<ThreadCounters> d_consumer_events;
+  std::atomic<bool> d_consumer_ready = false;
+  ThreadCounterValues d_producer;
+  ThreadCounterValues d_consumer;
+
+public:
+  // Timer paused: close the events of the last consumer thread.
+  void new_iteration() {
+    d_consumer_events.reset();
+    d_consumer_ready = false;
+  }
+
+  void resume_before_consumer(benchmark::State&) {}
+
+  void resume_after_consumer(benchmark::State& state) {
+    d_consumer_ready.wait(false);
+    state.ResumeTiming();
+  }
+
+  void consumer_start() {
+    d_consumer_events.emplace();
+    d_consumer_ready = true;
+    d_consumer_ready.notify_one();
+    d_consumer_events->start();
+  }
+
+  void consumer_stop() {
+    d_consumer += d_consumer_events->stop();
+  }
+
+  void producer_start() {
+    d_producer_events.start();
+  }
+
+  void producer_stop() {
+    d_producer += d_producer_events.stop();
+  }
+
+  void report(benchmark::State& state, size_t ticks, size_t visits) const {
+    reportThreadCounters(state, "Producer", "tick", d_producer, ticks);
+    reportThreadCounters(state, "Consumer", "visit", d_consumer, visits);
+  }
+};
+
+// Without counters the timer resumes before the consumer thread is
+// started, as it always has.
+template <>
+class SimulationCounters<false> {
+public:
+  void new_iteration() {}
+
+  void resume_before_consumer(benchmark::State& state) {
+    state.ResumeTiming();
+  }
+
+  void resume_after_consumer(benchmark::State&) {}
+  void consumer_start() {}
+  void consumer_stop() {}
+  void producer_start() {}
+  void producer_stop() {}
+  void report(benchmark::State&, size_t, size_t) const {}
+};
+
+// Benchmark for shared_ptr implementation. With LATENCY, every tick
+// and every visit is also timed into a histogram.
+template <bool LATENCY, bool COUNTERS>
+static void runSharedPtrSimulation(benchmark::State& state) {
 
   size_t sharedptr_tick_count = 0;
   size_t sharedptr_visit_count = 0;
   size_t total_objects_created = 0;
+  LatencyHistogram tick_latency;
+  LatencyHistogram visit_latency;
+  SimulationCounters<COUNTERS> counters;
   
   for (auto _ : state) {
     state.PauseTiming();
+    counters.new_iteration();
     
         
     const size_t depth = state.range(0);
     const size_t ticks = state.range(1);
     size_t current_age = 0;
     auto root = createSharedPtrTree(depth, current_age).value();
-    std::atomic<bool> running{true};
-    std::mutex root_mutex;
+    cpioo::FrameChannel<std::shared_ptr<const TestObjectSharedPtr>> frames;
+    frames.publish(root);
 
-    auto get_root_ref = [&]() {
-      std::lock_guard<std::mutex> lock(root_mutex);
-      return root;
-    };
-    auto set_root_ref = [&](std::shared_ptr<const TestObjectSharedPtr> new_root) {
-      std::lock_guard<std::mutex> lock(root_mutex);
-      root = new_root;
-    };
+    counters.resume_before_consumer(state);
 
-    state.ResumeTiming();
-
-    // Start consumer thread
+    // Start consumer thread, it sleeps until a new frame is published
     std::thread consumer_thread([&]() {
-      while (running.load()) {
+      counters.consumer_start();
+      uint64_t seen = 0;
+      while (auto frame = frames.wait_newer(seen)) {
+        seen = frame->sequence;
         sharedptr_visit_count++;
-        visitSharedPtrTreeNode(get_root_ref());
+        ScopedLatency<LATENCY> timer(visit_latency);
+        visitSharedPtrTreeNode(frame->value);
       }
+      counters.consumer_stop();
     });
+    counters.resume_after_consumer(state);
 
 
     // Run simulation for a fixed number of ticks
+    counters.producer_start();
     for (size_t i = 0; i < ticks; ++i) {
       sharedptr_tick_count++;
-      set_root_ref(simulateSharedPtrTick(get_root_ref(), MAX_AGE + i, total_objects_created).value());
+      ScopedLatency<LATENCY> timer(tick_latency);
+      root = simulateSharedPtrTick(root, MAX_AGE + i, total_objects_created).value();
+      frames.publish(root);
     }
+    counters.producer_stop();
     testobj_storage::return_free_pool_to_global();
     
     // Stop consumer thread
-    running.store(false);
+    frames.close();
     consumer_thread.join();
     
       }
@@ -218,54 +381,67 @@ static void BM_SharedPtrSimulation(benchmark::State& state) {
     total_objects_created,
     benchmark::Counter::kIsRate | benchmark::Counter::kAvgThreads
   );
+  counters.report(state, sharedptr_tick_count, sharedptr_visit_count);
+  if constexpr (LATENCY) {
+    reportLatency(state, "Tick", tick_latency);
+    reportLatency(state, "Visit", visit_latency);
+  }
 }
 
 // Benchmark for ManagedEntity implementation
-static void BM_ManagedEntitySimulation(benchmark::State& state) {
+template <bool LATENCY, bool COUNTERS>
+static void runManagedEntitySimulation(benchmark::State& state) {
   
   size_t managed_entity_tick_count = 0;
   size_t managed_entity_visit_count = 0;
   size_t total_objects_created = 0;
+  LatencyHistogram tick_latency;
+  LatencyHistogram visit_latency;
+  SimulationCounters<COUNTERS> counters;
 
   for (auto _ : state) {
     state.PauseTiming();
+    counters.new_iteration();
     
         
     const size_t depth = state.range(0);
     const size_t ticks = state.range(1);
     size_t current_age = 0;
     // Setup tree
-    auto root = std::make_unique<testobj_ref>(createManagedEntityTree(depth, current_age).value());
-    std::atomic<bool> running{true};
-    std::mutex root_mutex;
-
-    auto get_root_ref = [&]() {
-      std::lock_guard<std::mutex> lock(root_mutex);
-      return *root;
-    };
-    auto set_root_ref = [&](const testobj_ref& new_root) {
-      std::lock_guard<std::mutex> lock(root_mutex);
-      root = std::make_unique<testobj_ref>(new_root);
-    };
+    std::optional<testobj_ref> root = createManagedEntityTree<testobj_storage>(depth, current_age);
+    cpioo::FrameChannel<testobj_ref> frames;
+    frames.publish(root.value());
     
-    state.ResumeTiming();
+    counters.resume_before_consumer(state);
     
-    // Start consumer thread
+    // Start consumer thread, it sleeps until a new frame is published
     std::thread consumer_thread([&]() {
-      while (running.load()) {
+      counters.consumer_start();
+      uint64_t seen = 0;
+      while (auto frame = frames.wait_newer(seen)) {
+        seen = frame->sequence;
         managed_entity_visit_count++;
-        visitManagedEntityTreeNode(get_root_ref());
+        ScopedLatency<LATENCY> timer(visit_latency);
+        visitManagedEntityTreeNode<testobj_storage>(frame->value);
       }
+      counters.consumer_stop();
     });
+    counters.resume_after_consumer(state);
     
     // Run simulation for a fixed number of ticks
+    counters.producer_start();
     for (size_t i = 0; i < ticks; ++i) {
       managed_entity_tick_count++;
-      set_root_ref(simulateManagedEntityTick(get_root_ref(), MAX_AGE + i, total_objects_created).value());
+      ScopedLatency<LATENCY> timer(tick_latency);
+      auto next_root = simulateManagedEntityTick<testobj_storage>(root, MAX_AGE + i, total_objects_created).value();
+      frames.publish(next_root);
+      root.reset();
+      root.emplace(std::move(next_root));
     }
+    counters.producer_stop();
     
     // Stop consumer thread
-    running.store(false);
+    frames.close();
     consumer_thread.join();
     
       }
@@ -282,6 +458,158 @@ static void BM_ManagedEntitySimulation(benchmark::State& state) {
     total_objects_created,
     benchmark::Counter::kIsRate | benchmark::Counter::kAvgThreads
   );
+  counters.report(state, managed_entity_tick_count, managed_entity_visit_count);
+  if constexpr (LATENCY) {
+    reportLatency(state, "Tick", tick_latency);
+    reportLatency(state, "Visit", visit_latency);
+  }
+}
+
+// Benchmark for the mark-sweep storage
+template <bool LATENCY, bool COUNTERS>
+static void runMarkSweepSimulation(benchmark::State& state) {
+  
+  size_t mark_sweep_tick_count = 0;
+  size_t mark_sweep_visit_count = 0;
+  size_t total_objects_created = 0;
+  LatencyHistogram tick_latency;
+  LatencyHistogram visit_latency;
+  SimulationCounters<COUNTERS> counters;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    counters.new_iteration();
+    
+        
+    const size_t depth = state.range(0);
+    const size_t ticks = state.range(1);
+    size_t current_age = 0;
+    // Setup tree
+    std::optional<tracedobj_ref> root = createManagedEntityTree<tracedobj_storage>(depth, current_age);
+    cpioo::FrameChannel<tracedobj_ref> frames;
+    frames.publish(root.value());
+
+    // References don't keep anything alive here, so the consumer
+    // pins the frame it is visiting and the collector treats the pin
+    // as a root. Taking the frame and collecting both hold the pin
+    // mutex, so a frame can't be swept between the two.
+    std::mutex pin_mutex;
+    std::optional<tracedobj_ref> pinned;
+    
+    counters.resume_before_consumer(state);
+    
+    auto take_pinned_frame = [&](uint64_t seen) {
+      std::lock_guard<std::mutex> lock(pin_mutex);
+      auto frame = frames.try_get_newer(seen);
+      if (frame) {
+        pinned.reset();
+        pinned.emplace(frame->value);
+      }
+      return frame;
+    };
+
+    // Start consumer thread, it sleeps until a new frame is published
+    std::thread consumer_thread([&]() {
+      counters.consumer_start();
+      uint64_t seen = 0;
+      while (frames.wait_newer(seen)) {
+        auto frame = take_pinned_frame(seen);
+        if (!frame) {
+          continue;
+        }
+        seen = frame->sequence;
+        mark_sweep_visit_count++;
+        ScopedLatency<LATENCY> timer(visit_latency);
+        visitManagedEntityTreeNode<tracedobj_storage>(frame->value);
+      }
+      counters.consumer_stop();
+    });
+    counters.resume_after_consumer(state);
+    
+    // Run simulation for a fixed number of ticks
+    counters.producer_start();
+    for (size_t i = 0; i < ticks; ++i) {
+      mark_sweep_tick_count++;
+      ScopedLatency<LATENCY> timer(tick_latency);
+      auto next_root = simulateManagedEntityTick<tracedobj_storage>(root, MAX_AGE + i, total_objects_created).value();
+      frames.publish(next_root);
+      root.reset();
+      root.emplace(std::move(next_root));
+      if ((i + 1) % MARK_SWEEP_INTERVAL == 0) {
+        std::lock_guard<std::mutex> lock(pin_mutex);
+        tracedobj_storage::collect(root, pinned);
+      }
+    }
+    counters.producer_stop();
+    
+    // Stop consumer thread
+    frames.close();
+    consumer_thread.join();
+
+    // Reclaim the whole tree before the next iteration
+    root.reset();
+    pinned.reset();
+    tracedobj_storage::collect(root);
+    
+      }
+  // Add rate metrics with display flags to show as columns
+  state.counters["Tick_Rate"] = benchmark::Counter(
+    mark_sweep_tick_count, 
+    benchmark::Counter::kIsRate | benchmark::Counter::kAvgThreads
+  );
+  state.counters["Visit_Rate"] = benchmark::Counter(
+    mark_sweep_visit_count, 
+    benchmark::Counter::kIsRate | benchmark::Counter::kAvgThreads
+  );
+  state.counters["Objects_Creation_Rate"] = benchmark::Counter(
+    total_objects_created,
+    benchmark::Counter::kIsRate | benchmark::Counter::kAvgThreads
+  );
+  counters.report(state, mark_sweep_tick_count, mark_sweep_visit_count);
+  if constexpr (LATENCY) {
+    reportLatency(state, "Tick", tick_latency);
+    reportLatency(state, "Visit", visit_latency);
+  }
+}
+
+static void BM_SharedPtrSimulation(benchmark::State& state) {
+  runSharedPtrSimulation<false, false>(state);
+}
+
+static void BM_ManagedEntitySimulation(benchmark::State& state) {
+  runManagedEntitySimulation<false, false>(state);
+}
+
+static void BM_MarkSweepSimulation(benchmark::State& state) {
+  runMarkSweepSimulation<false, false>(state);
+}
+
+// Latency mode: same simulations, reporting tick and visit
+// percentiles instead of only the average rates.
+static void BM_SharedPtrLatency(benchmark::State& state) {
+  runSharedPtrSimulation<true, false>(state);
+}
+
+static void BM_ManagedEntityLatency(benchmark::State& state) {
+  runManagedEntitySimulation<true, false>(state);
+}
+
+static void BM_MarkSweepLatency(benchmark::State& state) {
+  runMarkSweepSimulation<true, false>(state);
+}
+
+// Counters mode: same simulations, reporting the page faults and
+// cache misses of the producer and consumer threads.
+static void BM_SharedPtrCounters(benchmark::State& state) {
+  runSharedPtrSimulation<false, true>(state);
+}
+
+static void BM_ManagedEntityCounters(benchmark::State& state) {
+  runManagedEntitySimulation<false, true>(state);
+}
+
+static void BM_MarkSweepCounters(benchmark::State& state) {
+  runMarkSweepSimulation<false, true>(state);
 }
 
 // Register benchmarks with different tree depths
@@ -295,5 +623,40 @@ BENCHMARK(BM_SharedPtrSimulation)
   ->UseRealTime()
   ->DisplayAggregatesOnly(true)
   ->Iterations(100);
+BENCHMARK(BM_MarkSweepSimulation)
+  ->Ranges({{8, 10}, {1000, 10000}})
+  ->UseRealTime()
+  ->DisplayAggregatesOnly(true)
+  ->Iterations(100);
+BENCHMARK(BM_ManagedEntityLatency)
+  ->Ranges({{8, 10}, {1000, 10000}})
+  ->UseRealTime()
+  ->DisplayAggregatesOnly(true)
+  ->Iterations(100);
+BENCHMARK(BM_SharedPtrLatency)
+  ->Ranges({{8, 10}, {1000, 10000}})
+  ->UseRealTime()
+  ->DisplayAggregatesOnly(true)
+  ->Iterations(100);
+BENCHMARK(BM_MarkSweepLatency)
+  ->Ranges({{8, 10}, {1000, 10000}})
+  ->UseRealTime()
+  ->DisplayAggregatesOnly(true)
+  ->Iterations(100);
+BENCHMARK(BM_ManagedEntityCounters)
+  ->Ranges({{8, 10}, {1000, 10000}})
+  ->UseRealTime()
+  ->DisplayAggregatesOnly(true)
+  ->Iterations(100);
+BENCHMARK(BM_SharedPtrCounters)
+  ->Ranges({{8, 10}, {1000, 10000}})
+  ->UseRealTime()
+  ->DisplayAggregatesOnly(true)
+  ->Iterations(100);
+BENCHMARK(BM_MarkSweepCounters)
+  ->Ranges({{8, 10}, {1000, 10000}})
+  ->UseRealTime()
+  ->DisplayAggregatesOnly(true)
+  ->Iterations(100);
 
 BENCHMARK_MAIN();
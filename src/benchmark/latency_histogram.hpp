@@ -0,0 +1,118 @@
+#ifndef CPIOO_BENCHMARK_LATENCY_HISTOGRAM_HPP
+#define CPIOO_BENCHMARK_LATENCY_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Histogram of durations in nanoseconds, in the style of
+// HdrHistogram: values below 2^SUB_BUCKET_BITS get a bucket each, and
+// every power of two above that is split in 2^(SUB_BUCKET_BITS-1)
+// buckets, so any recorded value is known to within 1/64 of itself
+// while the whole 64-bit range fits in a few thousand counters.
+class LatencyHistogram {
+  static constexpr std::size_t SUB_BUCKET_BITS = 7;
+  static constexpr std::size_t SUB_BUCKETS = std::size_t(1) << SUB_BUCKET_BITS;
+  static constexpr std::size_t HALF_SUB_BUCKETS = SUB_BUCKETS / 2;
+  static constexpr std::size_t BUCKETS =
+    SUB_BUCKETS + (64 - SUB_BUCKET_BITS) * HALF_SUB_BUCKETS;
+
+  std::array<uint64_t, BUCKETS> d_counts{};
+  uint64_t d_count = 0;
+  uint64_t d_max = 0;
+
+  static std::size_t bucket_of(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+      return value;
+    }
+    std::size_t shift = std::bit_width(value) - SUB_BUCKET_BITS;
+    return SUB_BUCKETS + (shift - 1) * HALF_SUB_BUCKETS
+      + ((value >> shift) - HALF_SUB_BUCKETS);
+  }
+
+  // Largest value that falls in the bucket.
+  static uint64_t highest_in_bucket(std::size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+      return bucket;
+    }
+    std::size_t k = bucket - SUB_BUCKETS;
+    std::size_t shift = k / HALF_SUB_BUCKETS + 1;
+    uint64_t mantissa = k % HALF_SUB_BUCKETS + HALF_SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+  }
+
+public:
+  void record(uint64_t nanoseconds) {
+    d_counts[bucket_of(nanoseconds)]++;
+    d_count++;
+    d_max = std::max(d_max, nanoseconds);
+  }
+
+  void record(std::chrono::nanoseconds duration) {
+    record(uint64_t(std::max<int64_t>(duration.count(), 0)));
+  }
+
+  void merge(const LatencyHistogram& other) {
+    for (std::size_t b = 0; b < BUCKETS; b++) {
+      d_counts[b] += other.d_counts[b];
+    }
+    d_count += other.d_count;
+    d_max = std::max(d_max, other.d_max);
+  }
+
+  uint64_t count() const {
+    return d_count;
+  }
+
+  uint64_t max() const {
+    return d_max;
+  }
+
+  // Smallest recorded value such that `percentile` percent of all
+  // values are at or below it, rounded up to its bucket.
+  uint64_t value_at_percentile(double percentile) const {
+    if (d_count == 0) {
+      return 0;
+    }
+    uint64_t rank = uint64_t(percentile / 100.0 * double(d_count) + 0.5);
+    rank = std::clamp<uint64_t>(rank, 1, d_count);
+    uint64_t seen = 0;
+    for (std::size_t b = 0; b < BUCKETS; b++) {
+      seen += d_counts[b];
+      if (seen >= rank) {
+        return std::min(highest_in_bucket(b), d_max);
+      }
+    }
+    return d_max;
+  }
+};
+
+// Records how long the scope took, or does nothing at all when
+// ENABLED is false so throughput runs don't pay for the clock.
+template <bool ENABLED>
+class ScopedLatency {
+  LatencyHistogram& d_histogram;
+  std::chrono::steady_clock::time_point d_start;
+
+public:
+  explicit ScopedLatency(LatencyHistogram& histogram)
+    : d_histogram(histogram), d_start(std::chrono::steady_clock::now()) {}
+
+  ScopedLatency(const ScopedLatency&) = delete;
+  ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+  ~ScopedLatency() {
+    d_histogram.record(std::chrono::steady_clock::now() - d_start);
+  }
+};
+
+template <>
+class ScopedLatency<false> {
+public:
+  explicit ScopedLatency(LatencyHistogram&) {}
+};
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef CPIOO_BENCHMARK_THREAD_COUNTERS_HPP
+#define CPIOO_BENCHMARK_THREAD_COUNTERS_HPP
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+
+// What one thread did to the memory system over some interval. The
+// hardware counters are only there when perf_event_open is allowed
+// (see /proc/sys/kernel/perf_event_paranoid) and the CPU has them.
+struct ThreadCounterValues {
+  uint64_t minor_faults = 0;
+  uint64_t major_faults = 0;
+  std::optional<uint64_t> cache_misses;
+  std::optional<uint64_t> llc_misses;
+  std::optional<uint64_t> dtlb_misses;
+
+  ThreadCounterValues& operator+=(const ThreadCounterValues& other) {
+    minor_faults += other.minor_faults;
+    major_faults += other.major_faults;
+    auto add = [](std::optional<uint64_t>& into, const std::optional<uint64_t>& value) {
+      if (value.has_value()) {
+        into = into.value_or(0) + *value;
+      }
+    };
+    add(cache_misses, other.cache_misses);
+    add(llc_misses, other.llc_misses);
+    add(dtlb_misses, other.dtlb_misses);
+    return *this;
+  }
+};
+
+// Counts page faults and cache misses of the calling thread between
+// start() and stop(). Must be created, started and stopped on the
+// thread being measured. Opening the events is a system call per
+// event, so create one outside the timed region and start and stop it
+// around the work. Hardware events that can't be opened are left out
+// rather than failing the benchmark.
+//
+// When the CPU has fewer counters than events, the kernel multiplexes
+// them and each one only counts part of the time. Counts are then
+// scaled up by how long the event was enabled over how long it ran,
+// as perf stat does.
+class ThreadCounters {
+  enum event { CACHE_MISSES, LLC_MISSES, DTLB_MISSES, EVENT_COUNT };
+
+  // What read() returns with TOTAL_TIME_ENABLED and TOTAL_TIME_RUNNING.
+  struct reading {
+    uint64_t count = 0;
+    uint64_t time_enabled = 0;
+    uint64_t time_running = 0;
+  };
+
+  std::array<int, EVENT_COUNT> d_fds;
+  std::array<reading, EVENT_COUNT> d_start_readings{};
+  rusage d_start_usage{};
+
+  static int open_event(uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // user space only, which is all an unprivileged process may see
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+
+  static constexpr uint64_t cache_read_miss(uint64_t cache) {
+    return cache
+      | (uint64_t(PERF_COUNT_HW_CACHE_OP_READ) << 8)
+      | (uint64_t(PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+  }
+
+  std::optional<reading> read_event(event e) const {
+    reading r;
+    if (d_fds[e] < 0 || read(d_fds[e], &r, sizeof(r)) != sizeof(r)) {
+      return std::nullopt;
+    }
+    return r;
+  }
+
+  // Count since start(), scaled for the time the event was not
+  // scheduled. Null if the event never ran.
+  std::optional<uint64_t> count_since_start(event e) const {
+    std::optional<reading> end = read_event(e);
+    if (!end) {
+      return std::nullopt;
+    }
+    const reading& start = d_start_readings[e];
+    uint64_t count = end->count - start.count;
+    uint64_t enabled = end->time_enabled - start.time_enabled;
+    uint64_t running = end->time_running - start.time_running;
+    if (running == 0) {
+      return std::nullopt;
+    }
+    if (running < enabled) {
+      count = uint64_t(double(count) * double(enabled) / double(running));
+    }
+    return count;
+  }
+
+public:
+  ThreadCounters() {
+    d_fds[CACHE_MISSES] =
+      open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    d_fds[LLC_MISSES] =
+      open_event(PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_LL));
+    d_fds[DTLB_MISSES] =
+      open_event(PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_DTLB));
+  }
+
+  ThreadCounters(const ThreadCounters&) = delete;
+  ThreadCounters& operator=(const ThreadCounters&) = delete;
+
+  ~ThreadCounters() {
+    for (int fd : d_fds) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+
+  // Rather than resetting the events, start() reads them and stop()
+  // reports the difference: a reset clears the count but not the
+  // enabled and running times the scaling needs.
+  void start() {
+    for (int e = 0; e < EVENT_COUNT; e++) {
+      if (d_fds[e] >= 0) {
+        ioctl(d_fds[e], PERF_EVENT_IOC_ENABLE, 0);
+        d_start_readings[e] = read_event(event(e)).value_or(reading{});
+      }
+    }
+    getrusage(RUSAGE_THREAD, &d_start_usage);
+  }
+
+  ThreadCounterValues stop() {
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    for (int fd : d_fds) {
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+    ThreadCounterValues values;
+    values.minor_faults = usage.ru_minflt - d_start_usage.ru_minflt;
+    values.major_faults = usage.ru_majflt - d_start_usage.ru_majflt;
+    values.cache_misses = count_since_start(CACHE_MISSES);
+    values.llc_misses = count_since_start(LLC_MISSES);
+    values.dtlb_misses = count_since_start(DTLB_MISSES);
+    return values;
+  }
+};
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef CPIOO_BUFFER_DIRECTORY_HPP
+#define CPIOO_BUFFER_DIRECTORY_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <type_traits>
+
+namespace cpioo {
+  namespace managed_entity {
+
+    // Sparse table of ENTRY_COUNT entries, allocated one page at a
+    // time when an entry in the page is first created.
+    //
+    // Storages find their buffers through one of these instead of a
+    // flat array with a pointer per possible buffer, so a wide index
+    // type only costs a small root table until the index space is
+    // actually used. Up to 2^22 entries there are two levels, a root
+    // table and leaf pages; larger tables get a middle level.
+    //
+    // Entries read with operator[] must have been created, and the
+    // caller must publish them to other threads, as storages do by
+    // bumping their capacity after growing.
+    template <class ENTRY, std::size_t ENTRY_COUNT>
+    class buffer_directory {
+    public:
+      static constexpr std::size_t ENTRY_BITS = std::bit_width(ENTRY_COUNT - 1);
+      static constexpr std::size_t LEVELS = ENTRY_BITS <= 22 ? 2 : 3;
+      static constexpr std::size_t LEAF_BITS =
+        LEVELS == 2 ? std::min<std::size_t>(ENTRY_BITS, 11) : (ENTRY_BITS + 2) / 3;
+      static constexpr std::size_t MIDDLE_BITS =
+        LEVELS == 2 ? 0 : (ENTRY_BITS + 2) / 3;
+      static constexpr std::size_t ROOT_BITS = ENTRY_BITS - LEAF_BITS - MIDDLE_BITS;
+
+      using leaf = std::array<ENTRY, std::size_t(1) << LEAF_BITS>;
+      using middle = std::array<std::atomic<leaf*>, std::size_t(1) << MIDDLE_BITS>;
+      using root_entry = std::conditional_t<
+        LEVELS == 2, std::atomic<leaf*>, std::atomic<middle*>>;
+
+    private:
+      std::array<root_entry, std::size_t(1) << ROOT_BITS> d_root{};
+      std::atomic<std::size_t> d_pages = 0;
+
+      constexpr static std::size_t leaf_slot(std::size_t i) {
+        return i & ((std::size_t(1) << LEAF_BITS) - 1);
+      }
+
+      constexpr static std::size_t middle_slot(std::size_t i) {
+        return (i >> LEAF_BITS) & ((std::size_t(1) << MIDDLE_BITS) - 1);
+      }
+
+      constexpr static std::size_t root_slot(std::size_t i) {
+        return i >> (LEAF_BITS + MIDDLE_BITS);
+      }
+
+      // Allocate the page behind `slot` unless some thread already
+      // did.
+      template <class PAGE>
+      PAGE* ensure(std::atomic<PAGE*>& slot) {
+        PAGE* page = slot.load(std::memory_order_acquire);
+        if (page == nullptr) {
+          PAGE* created = new PAGE{};
+          if (slot.compare_exchange_strong(page, created, std::memory_order_acq_rel)) {
+            page = created;
+            d_pages++;
+          } else {
+            delete created;
+          }
+        }
+        return page;
+      }
+
+    public:
+      buffer_directory() = default;
+      buffer_directory(const buffer_directory&) = delete;
+      buffer_directory& operator=(const buffer_directory&) = delete;
+
+      // Pages live as long as the storage buffers they point to, which
+      // is the whole process, so they are never freed.
+
+      ENTRY& operator[](std::size_t i) const {
+        leaf* l;
+        if constexpr (LEVELS == 2) {
+          l = d_root[root_slot(i)].load(std::memory_order_acquire);
+        } else {
+          middle* m = d_root[root_slot(i)].load(std::memory_order_acquire);
+          l = (*m)[middle_slot(i)].load(std::memory_order_acquire);
+        }
+        return (*l)[leaf_slot(i)];
+      }
+
+      // Entry i, allocating the pages that hold it if needed. New
+      // entries are value-initialized.
+      ENTRY& create(std::size_t i) {
+        leaf* l;
+        if constexpr (LEVELS == 2) {
+          l = ensure(d_root[root_slot(i)]);
+        } else {
+          middle* m = ensure(d_root[root_slot(i)]);
+          l = ensure((*m)[middle_slot(i)]);
+        }
+        return (*l)[leaf_slot(i)];
+      }
+
+      // Entry i, or null if the page that would hold it was never
+      // allocated.
+      ENTRY* find(std::size_t i) const {
+        leaf* l;
+        if constexpr (LEVELS == 2) {
+          l = d_root[root_slot(i)].load(std::memory_order_acquire);
+        } else {
+          middle* m = d_root[root_slot(i)].load(std::memory_order_acquire);
+          if (m == nullptr) {
+            return nullptr;
+          }
+          l = (*m)[middle_slot(i)].load(std::memory_order_acquire);
+        }
+        return l == nullptr ? nullptr : &(*l)[leaf_slot(i)];
+      }
+
+      // Call f on every entry of every allocated page. Must not run
+      // concurrently with create.
+      template <class F>
+      void for_each_entry(F&& f) {
+        auto visit_leaf = [&f](leaf* l) {
+          if (l != nullptr) {
+            for (auto& entry : *l) {
+              f(entry);
+            }
+          }
+        };
+        for (auto& root : d_root) {
+          if constexpr (LEVELS == 2) {
+            visit_leaf(root.load());
+          } else {
+            middle* m = root.load();
+            if (m != nullptr) {
+              for (auto& l : *m) {
+                visit_leaf(l.load());
+              }
+            }
+          }
+        }
+      }
+
+      // Free every page, but not anything the entries point to, for
+      // owners that don't live as long as the process, such as a side
+      // table. Must not run concurrently with anything else.
+      void clear() {
+        for (auto& root : d_root) {
+          if constexpr (LEVELS == 2) {
+            delete root.exchange(nullptr);
+          } else {
+            middle* m = root.exchange(nullptr);
+            if (m != nullptr) {
+              for (auto& l : *m) {
+                delete l.load();
+              }
+              delete m;
+            }
+          }
+        }
+        d_pages = 0;
+      }
+
+      // How many pages (leaf and middle) have been allocated.
+      std::size_t pages() const {
+        return d_pages;
+      }
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,409 @@
+#ifndef CPIOO_DELTA_STREAM_HPP
+#define CPIOO_DELTA_STREAM_HPP
+
+#include <cpioo/managed_entity.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace cpioo {
+  namespace managed_entity {
+
+    // Replication of frames as deltas against the previously sent
+    // frame.
+    //
+    // The encoder walks the new frame alongside the previous one,
+    // child by child. A child that is the same reference as the one in
+    // the same position of the previous frame is sent as a one-byte
+    // SAME record and not visited, so the stream (and the work to
+    // produce it) grows with the number of entities created since the
+    // previous frame, not with the size of the tree. The decoder does
+    // the same walk over its replica of the previous frame, reusing
+    // its references for SAME records, so the replica shares unchanged
+    // subtrees between frames just like the original.
+    //
+    // A new entity reachable more than once in the same frame is sent
+    // once and referred back to afterwards. An old entity that moved
+    // to a different position is sent again as a new one.
+    //
+    // A delta has two parts. The shape comes first: the record of the
+    // root and, after every NEW record, the number of children of that
+    // entity and their records, depth first. Then come the fields of
+    // every new entity, children before their parents, which is the
+    // order the decoder can make them in. Both sides walk with an
+    // explicit stack, so a frame can be as deep as memory allows.
+    //
+    // The entity type T must provide, findable through ADL,
+    //
+    //   template <class F> void for_each_child(const T&, F&& f);
+    //   void encode_entity(const T&, delta_encoder<STORAGE>& out);
+    //   STORAGE::ref_type decode_entity(delta_decoder<STORAGE>& in);
+    //
+    // for_each_child calls f on every child reference (or optional
+    // reference) in STORAGE, always in the same order. encode_entity
+    // writes the fields with the write_* calls and every child with
+    // write_child, in that same order; decode_entity reads them back
+    // in the same order and makes the entity.
+    namespace delta {
+      enum tag : uint8_t {
+        NONE = 0,
+        SAME = 1,
+        NEW = 2,
+        REPEAT = 3,
+      };
+
+      template <class REF>
+      inline const REF* as_pointer(const REF& ref) {
+        return &ref;
+      }
+
+      template <class REF>
+      inline const REF* as_pointer(const std::optional<REF>& ref) {
+        return ref.has_value() ? &*ref : nullptr;
+      }
+
+      inline void append_varint(std::vector<uint8_t>& out, uint64_t value) {
+        while (value >= 0x80) {
+          out.push_back(uint8_t(value) | 0x80);
+          value >>= 7;
+        }
+        out.push_back(uint8_t(value));
+      }
+
+      // Append the first `count` children of the entity at the same
+      // position in the previous frame, in for_each_child order, with
+      // nullptr for the ones it doesn't have.
+      template <class STORAGE>
+      inline void append_counterparts(std::vector<const typename STORAGE::ref_type*>& out,
+                                      const typename STORAGE::type* previous,
+                                      std::size_t count) {
+        std::size_t first = out.size();
+        out.resize(first + count, nullptr);
+        if (previous != nullptr) {
+          std::size_t i = 0;
+          for_each_child(*previous, [&](const auto& child) {
+            if (i < count) {
+              out[first + i] = as_pointer(child);
+            }
+            i++;
+          });
+        }
+      }
+    }
+
+    template <class STORAGE>
+    class delta_encoder {
+    public:
+      using ref_type = typename STORAGE::ref_type;
+
+    private:
+      using type = typename STORAGE::type;
+      using index_type = typename STORAGE::index_type;
+
+      // A new entity whose children are being sent. Its children, then
+      // their counterparts in the previous frame, are in d_links from
+      // `links` on.
+      struct frame {
+        const type* entity;
+        index_type index;
+        std::size_t links;
+        std::size_t count;
+        std::size_t position;
+      };
+
+      std::vector<uint8_t> d_out;
+      std::vector<uint8_t> d_fields;
+      // Slot index of every new entity sent in this delta, to the
+      // order it was sent in.
+      std::unordered_map<index_type, uint64_t> d_sent;
+      std::vector<frame> d_stack;
+      std::vector<const ref_type*> d_links;
+      std::size_t d_entities = 0;
+
+      void encode_child(const ref_type* previous, const ref_type* next) {
+        if (next == nullptr) {
+          d_out.push_back(delta::NONE);
+          return;
+        }
+        if (previous != nullptr && *previous == *next) {
+          d_out.push_back(delta::SAME);
+          return;
+        }
+        auto sent = d_sent.find(next->index());
+        if (sent != d_sent.end()) {
+          d_out.push_back(delta::REPEAT);
+          delta::append_varint(d_out, sent->second);
+          return;
+        }
+
+        d_out.push_back(delta::NEW);
+        frame f{next->get(), next->index(), d_links.size(), 0, 0};
+        for_each_child(*f.entity, [&](const auto& child) {
+          d_links.push_back(delta::as_pointer(child));
+          f.count++;
+        });
+        delta::append_counterparts<STORAGE>(
+          d_links, previous != nullptr ? previous->get() : nullptr, f.count);
+        delta::append_varint(d_out, f.count);
+        d_stack.push_back(f);
+      }
+
+      // Send the children of the entities on the stack, and the fields
+      // of each entity once all of its children were sent.
+      void walk() {
+        while (!d_stack.empty()) {
+          frame& top = d_stack.back();
+          if (top.position < top.count) {
+            std::size_t i = top.links + top.position++;
+            encode_child(d_links[i + top.count], d_links[i]);
+            continue;
+          }
+          const type* entity = top.entity;
+          index_type index = top.index;
+          d_links.resize(top.links);
+          d_stack.pop_back();
+          encode_entity(*entity, *this);
+          // Numbered once complete, which is when the decoder makes it.
+          d_sent.emplace(index, d_entities++);
+        }
+      }
+
+    public:
+      delta_encoder() = default;
+
+      // Encode `next` as a delta against `previous`, the frame the
+      // receiving side already has (nullopt for the first frame). The
+      // returned bytes stay valid until the next call.
+      std::span<const uint8_t> encode(const std::optional<ref_type>& previous,
+                                      const std::optional<ref_type>& next) {
+        d_out.clear();
+        d_fields.clear();
+        d_sent.clear();
+        d_entities = 0;
+        encode_child(delta::as_pointer(previous), delta::as_pointer(next));
+        walk();
+        d_out.insert(d_out.end(), d_fields.begin(), d_fields.end());
+        return d_out;
+      }
+
+      // How many entities the last delta carried.
+      std::size_t entities() const {
+        return d_entities;
+      }
+
+      void write_varint(uint64_t value) {
+        delta::append_varint(d_fields, value);
+      }
+
+      void write_signed(int64_t value) {
+        write_varint((uint64_t(value) << 1) ^ uint64_t(value >> 63));
+      }
+
+      void write_bytes(const void* data, std::size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        d_fields.insert(d_fields.end(), bytes, bytes + size);
+      }
+
+      // The children were sent with the shape already; these only
+      // mark where decode_entity reads them back.
+      void write_child(const ref_type&) {}
+
+      void write_child(const std::optional<ref_type>&) {}
+    };
+
+    template <class STORAGE>
+    class delta_decoder {
+    public:
+      using ref_type = typename STORAGE::ref_type;
+
+    private:
+      // A child as read from the shape: none, the child at the same
+      // position of the previous frame, or the n-th new entity.
+      struct link {
+        delta::tag tag;
+        const ref_type* previous;
+        uint64_t created;
+      };
+
+      // A new entity whose children are being read. Their counterparts
+      // in the previous frame are in d_previous from `previous` on, the
+      // links read so far in d_pending from `pending` on.
+      struct frame {
+        std::size_t previous;
+        std::size_t pending;
+        std::size_t count;
+        std::size_t position;
+      };
+
+      const uint8_t* d_pos = nullptr;
+      const uint8_t* d_end = nullptr;
+      std::vector<ref_type> d_created;
+      std::vector<frame> d_stack;
+      std::vector<const ref_type*> d_previous;
+      std::vector<link> d_pending;
+      // Children of the stack's entities not read yet.
+      std::size_t d_outstanding = 0;
+      // Children of every new entity, in the order the entities are
+      // made, and where the children of each one start.
+      std::vector<link> d_links;
+      std::vector<std::size_t> d_first_link;
+      std::size_t d_next_link = 0;
+      std::size_t d_end_link = 0;
+
+      [[noreturn]] static void malformed() {
+        std::cerr << "Malformed delta stream." << std::endl;
+        std::abort();
+      }
+
+      uint8_t read_byte() {
+        if (d_pos == d_end) {
+          malformed();
+        }
+        return *d_pos++;
+      }
+
+      // Read the record of one child into d_pending, or start reading
+      // the children of a new entity.
+      void read_record(const ref_type* previous) {
+        switch (read_byte()) {
+        case delta::NONE:
+          d_pending.push_back({delta::NONE, nullptr, 0});
+          return;
+        case delta::SAME:
+          if (previous == nullptr) {
+            malformed();
+          }
+          d_pending.push_back({delta::SAME, previous, 0});
+          return;
+        case delta::REPEAT: {
+          uint64_t n = read_varint();
+          if (n >= d_first_link.size() - 1) {
+            malformed();
+          }
+          d_pending.push_back({delta::REPEAT, nullptr, n});
+          return;
+        }
+        case delta::NEW: {
+          uint64_t count = read_varint();
+          // every child still to read takes at least a byte
+          if (count > uint64_t(d_end - d_pos) - d_outstanding) {
+            malformed();
+          }
+          d_outstanding += count;
+          frame f{d_previous.size(), d_pending.size(), std::size_t(count), 0};
+          delta::append_counterparts<STORAGE>(
+            d_previous, previous != nullptr ? previous->get() : nullptr, f.count);
+          d_stack.push_back(f);
+          return;
+        }
+        default:
+          malformed();
+        }
+      }
+
+      // Read the shape, numbering the new entities in the order they
+      // complete.
+      void read_shape(const ref_type* previous) {
+        read_record(previous);
+        while (!d_stack.empty()) {
+          frame& top = d_stack.back();
+          if (top.position < top.count) {
+            d_outstanding--;
+            read_record(d_previous[top.previous + top.position++]);
+            continue;
+          }
+          d_links.insert(d_links.end(), d_pending.begin() + top.pending, d_pending.end());
+          d_first_link.push_back(d_links.size());
+          d_pending.resize(top.pending);
+          d_previous.resize(top.previous);
+          d_stack.pop_back();
+          d_pending.push_back({delta::REPEAT, nullptr, d_first_link.size() - 2});
+        }
+      }
+
+      std::optional<ref_type> resolve(const link& l) {
+        switch (l.tag) {
+        case delta::SAME:
+          return *l.previous;
+        case delta::REPEAT:
+          return d_created[l.created];
+        default:
+          return std::nullopt;
+        }
+      }
+
+    public:
+      delta_decoder() = default;
+
+      // Apply a delta to `previous`, this side's replica of the frame
+      // it was encoded against, returning the replica of the new
+      // frame.
+      std::optional<ref_type> decode(std::span<const uint8_t> bytes,
+                                     const std::optional<ref_type>& previous) {
+        d_pos = bytes.data();
+        d_end = bytes.data() + bytes.size();
+        d_created.clear();
+        d_pending.clear();
+        d_outstanding = 0;
+        d_links.clear();
+        d_first_link.assign(1, 0);
+        read_shape(delta::as_pointer(previous));
+
+        for (std::size_t n = 0; n + 1 < d_first_link.size(); n++) {
+          d_next_link = d_first_link[n];
+          d_end_link = d_first_link[n + 1];
+          ref_type created = decode_entity(*this);
+          if (d_next_link != d_end_link) {
+            malformed();
+          }
+          d_created.push_back(created);
+        }
+        if (d_pos != d_end) {
+          malformed();
+        }
+        return resolve(d_pending.back());
+      }
+
+      uint64_t read_varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+          uint8_t byte = read_byte();
+          value |= uint64_t(byte & 0x7f) << shift;
+          if ((byte & 0x80) == 0) {
+            return value;
+          }
+        }
+        malformed();
+      }
+
+      int64_t read_signed() {
+        uint64_t value = read_varint();
+        return int64_t(value >> 1) ^ -int64_t(value & 1);
+      }
+
+      void read_bytes(void* data, std::size_t size) {
+        if (std::size_t(d_end - d_pos) < size) {
+          malformed();
+        }
+        std::memcpy(data, d_pos, size);
+        d_pos += size;
+      }
+
+      std::optional<ref_type> read_child() {
+        if (d_next_link == d_end_link) {
+          malformed();
+        }
+        return resolve(d_links[d_next_link++]);
+      }
+    };
+
+  }
+}
+
+#endif
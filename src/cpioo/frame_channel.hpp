@@ -0,0 +1,236 @@
+#ifndef CPIOO_FRAME_CHANNEL_HPP
+#define CPIOO_FRAME_CHANNEL_HPP
+
+#include <cpioo/version.hpp>
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace cpioo {
+
+/**
+ * @brief A single-slot publication channel for immutable frames
+ *
+ * The producer publishes frames and readers ask for "the next frame
+ * after the one I've seen". Only the latest frame is kept, so a
+ * reader that falls behind skips straight to the newest frame instead
+ * of working through a backlog, and a reader never receives the same
+ * frame twice.
+ *
+ * Readers can either block (the wait is a futex-style wait on an
+ * atomic word, so an idle reader sleeps instead of spinning) or
+ * co_await the next frame from a coroutine. Suspended coroutines are
+ * resumed inline on the publishing thread.
+ */
+template <typename T>
+class FrameChannel {
+public:
+    /**
+     * @brief A published value tagged with its sequence number
+     *
+     * Sequence numbers start at 1, so 0 can be used by readers to
+     * mean "nothing seen yet".
+     */
+    struct Frame {
+        T value;
+        uint64_t sequence;
+    };
+
+    class NextFrameAwaiter;
+
+private:
+    mutable std::mutex d_mutex;
+    std::optional<Frame> d_latest;
+    bool d_closed = false;
+    uint64_t d_sequence = 0;
+    std::vector<std::pair<std::coroutine_handle<>, NextFrameAwaiter*>> d_suspended;
+
+    // Bumped on every publish and on close. Blocking readers wait on
+    // this word, so a publish that nobody is waiting for costs one
+    // atomic increment and a notify with no sleepers.
+    std::atomic<uint64_t> d_epoch{0};
+
+    // Must be called with d_mutex held.
+    std::optional<Frame> newer_locked(uint64_t seen) const {
+        if (d_latest && d_latest->sequence > seen) {
+            return Frame{d_latest->value, d_latest->sequence};
+        }
+        return std::nullopt;
+    }
+
+    void wake(std::vector<std::pair<std::coroutine_handle<>, NextFrameAwaiter*>> suspended) {
+        d_epoch.fetch_add(1, std::memory_order_release);
+        d_epoch.notify_all();
+        for (auto& [handle, awaiter] : suspended) {
+            handle.resume();
+        }
+    }
+
+public:
+    FrameChannel() = default;
+    FrameChannel(const FrameChannel&) = delete;
+    FrameChannel& operator=(const FrameChannel&) = delete;
+
+    /**
+     * @brief Awaitable returned by next()
+     *
+     * Resolves to the first frame newer than the given sequence, or
+     * std::nullopt if the channel was closed.
+     */
+    class NextFrameAwaiter {
+        friend class FrameChannel;
+        FrameChannel& d_channel;
+        uint64_t d_seen;
+        std::optional<Frame> d_result;
+        // Set while the channel holds on to this awaiter.
+        std::atomic<bool> d_registered{false};
+
+    public:
+        NextFrameAwaiter(FrameChannel& channel, uint64_t seen)
+            : d_channel(channel), d_seen(seen) {}
+
+        NextFrameAwaiter(const NextFrameAwaiter&) = delete;
+        NextFrameAwaiter& operator=(const NextFrameAwaiter&) = delete;
+
+        // An awaiter destroyed while suspended (its coroutine was
+        // destroyed) must not be resumed by a later publish.
+        ~NextFrameAwaiter() {
+            if (d_registered.load(std::memory_order_acquire)) {
+                std::lock_guard<std::mutex> lock(d_channel.d_mutex);
+                auto& suspended = d_channel.d_suspended;
+                for (auto i = suspended.begin(); i != suspended.end(); ++i) {
+                    if (i->second == this) {
+                        suspended.erase(i);
+                        break;
+                    }
+                }
+            }
+        }
+
+        bool await_ready() {
+            std::lock_guard<std::mutex> lock(d_channel.d_mutex);
+            d_result = d_channel.newer_locked(d_seen);
+            return d_result.has_value() || d_channel.d_closed;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            std::lock_guard<std::mutex> lock(d_channel.d_mutex);
+            // A frame may have been published since await_ready.
+            d_result = d_channel.newer_locked(d_seen);
+            if (d_result.has_value() || d_channel.d_closed) {
+                return false;
+            }
+            d_channel.d_suspended.emplace_back(handle, this);
+            d_registered.store(true, std::memory_order_release);
+            return true;
+        }
+
+        std::optional<Frame> await_resume() {
+            return std::move(d_result);
+        }
+    };
+
+    /**
+     * @brief Publish a new frame, replacing any frame not yet consumed
+     * @param value The frame to publish
+     * @return The sequence number assigned to the frame
+     */
+    uint64_t publish(T value) {
+        std::vector<std::pair<std::coroutine_handle<>, NextFrameAwaiter*>> suspended;
+        uint64_t sequence;
+        {
+            std::lock_guard<std::mutex> lock(d_mutex);
+            sequence = ++d_sequence;
+            d_latest.emplace(Frame{std::move(value), sequence});
+            for (auto& [handle, awaiter] : d_suspended) {
+                awaiter->d_result.emplace(Frame{d_latest->value, sequence});
+                awaiter->d_registered.store(false, std::memory_order_release);
+            }
+            std::swap(suspended, d_suspended);
+        }
+        wake(std::move(suspended));
+        return sequence;
+    }
+
+    /**
+     * @brief Close the channel, waking every waiting reader
+     *
+     * Readers that already saw the latest frame get std::nullopt from
+     * then on; a reader that hasn't seen it yet still receives it.
+     */
+    void close() {
+        std::vector<std::pair<std::coroutine_handle<>, NextFrameAwaiter*>> suspended;
+        {
+            std::lock_guard<std::mutex> lock(d_mutex);
+            d_closed = true;
+            for (auto& [handle, awaiter] : d_suspended) {
+                awaiter->d_registered.store(false, std::memory_order_release);
+            }
+            std::swap(suspended, d_suspended);
+        }
+        wake(std::move(suspended));
+    }
+
+    /**
+     * @brief Get the latest frame if it is newer than the given sequence
+     * @param seen The sequence of the last frame the reader processed
+     * @return The latest frame, or std::nullopt if there is none newer
+     */
+    std::optional<Frame> try_get_newer(uint64_t seen) const {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        return newer_locked(seen);
+    }
+
+    /**
+     * @brief Block until a frame newer than the given sequence exists
+     * @param seen The sequence of the last frame the reader processed
+     * @return The latest frame, or std::nullopt once the channel is
+     *         closed and there is nothing newer
+     */
+    std::optional<Frame> wait_newer(uint64_t seen) {
+        while (true) {
+            uint64_t epoch = d_epoch.load(std::memory_order_acquire);
+            {
+                std::lock_guard<std::mutex> lock(d_mutex);
+                auto frame = newer_locked(seen);
+                if (frame || d_closed) {
+                    return frame;
+                }
+            }
+            d_epoch.wait(epoch, std::memory_order_acquire);
+        }
+    }
+
+    /**
+     * @brief co_await the first frame newer than the given sequence
+     * @param seen The sequence of the last frame the reader processed
+     */
+    NextFrameAwaiter next(uint64_t seen) {
+        return NextFrameAwaiter(*this, seen);
+    }
+
+    /**
+     * @brief Sequence number of the most recently published frame
+     */
+    uint64_t sequence() const {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        return d_sequence;
+    }
+
+    /**
+     * @brief Check whether close() has been called
+     */
+    bool closed() const {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        return d_closed;
+    }
+};
+
+} // namespace cpioo
+
+#endif // CPIOO_FRAME_CHANNEL_HPP
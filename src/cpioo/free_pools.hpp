@@ -0,0 +1,79 @@
+#ifndef CPIOO_FREE_POOLS_HPP
+#define CPIOO_FREE_POOLS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cpioo {
+  namespace managed_entity {
+
+    // Cooperative hooks for returning the free slots threads keep
+    // cached in every storage.
+    //
+    // Each storage caches a few blocks of free slots per thread, and
+    // only hands them back to the shared bitmaps when the cache goes
+    // past its watermark or the thread exits. Long-lived workers that
+    // go idle would otherwise sit on their slots while busy threads
+    // grow the storages.
+    //
+    // A thread's cache is only ever touched by that thread, so nothing
+    // here can take slots from a thread that is blocked or idle. Such
+    // threads have to call return_on_this_thread themselves before
+    // they block.
+    namespace free_pools {
+
+      // A thread's free pool in one storage.
+      struct thread_pool {
+        void* pool;
+        std::size_t (*flush)(void* pool);
+      };
+
+      // Bumped to ask every thread to return its cached slots.
+      inline std::atomic<uint64_t> s_return_epoch = 0;
+
+      // Pools of the calling thread, registered by the storages as the
+      // thread first uses them.
+      inline thread_local std::vector<thread_pool> t_pools;
+
+      inline void add_thread_pool(void* pool, std::size_t (*flush)(void*)) {
+        t_pools.push_back({pool, flush});
+      }
+
+      inline void remove_thread_pool(void* pool) {
+        for (auto i = t_pools.begin(); i != t_pools.end(); i++) {
+          if (i->pool == pool) {
+            t_pools.erase(i);
+            return;
+          }
+        }
+      }
+
+      // Ask threads to return their cached slots. A thread only sees
+      // the request in a storage the next time it allocates or releases
+      // an entity there; caches in storages it no longer touches stay
+      // where they are. For when the live set shrank and the memory
+      // should follow, e.g. after a scene was unloaded.
+      inline void request_return() {
+        s_return_epoch.fetch_add(1, std::memory_order_release);
+      }
+
+      // Return the calling thread's cached slots in every storage it
+      // used, and how many slots that made available. Only the calling
+      // thread's caches are flushed. Worker threads call this before
+      // going idle, since idle threads never see request_return.
+      inline std::size_t return_on_this_thread() {
+        std::size_t count = 0;
+        for (auto& p : t_pools) {
+          count += p.flush(p.pool);
+        }
+        return count;
+      }
+
+    }
+
+  }
+}
+
+#endif
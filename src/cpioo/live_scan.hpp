@@ -0,0 +1,59 @@
+#ifndef CPIOO_LIVE_SCAN_HPP
+#define CPIOO_LIVE_SCAN_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace cpioo {
+  namespace managed_entity {
+
+    // Slots a storage scan tests for liveness at a time.
+    constexpr std::size_t LIVE_SCAN_WIDTH = 16;
+
+    // Bit i is set when counts[i] is not zero, for the
+    // LIVE_SCAN_WIDTH counts starting at `counts`.
+    //
+    // The counts are read with plain vector loads rather than one
+    // atomic load each, so a count changing during the scan may be
+    // seen either way; callers only rely on counts that are stable
+    // while they scan.
+    template <typename REFCNT_TYPE>
+    inline uint32_t live_mask(const std::atomic<REFCNT_TYPE>* counts) {
+      static_assert(sizeof(std::atomic<REFCNT_TYPE>) == sizeof(REFCNT_TYPE));
+#if defined(__SSE2__)
+      const __m128i* p = reinterpret_cast<const __m128i*>(counts);
+      const __m128i zero = _mm_setzero_si128();
+      if constexpr (sizeof(REFCNT_TYPE) == 2) {
+        __m128i dead = _mm_packs_epi16(
+          _mm_cmpeq_epi16(_mm_loadu_si128(p), zero),
+          _mm_cmpeq_epi16(_mm_loadu_si128(p + 1), zero));
+        return ~uint32_t(_mm_movemask_epi8(dead)) & 0xffff;
+      } else if constexpr (sizeof(REFCNT_TYPE) == 4) {
+        __m128i dead_low = _mm_packs_epi32(
+          _mm_cmpeq_epi32(_mm_loadu_si128(p), zero),
+          _mm_cmpeq_epi32(_mm_loadu_si128(p + 1), zero));
+        __m128i dead_high = _mm_packs_epi32(
+          _mm_cmpeq_epi32(_mm_loadu_si128(p + 2), zero),
+          _mm_cmpeq_epi32(_mm_loadu_si128(p + 3), zero));
+        __m128i dead = _mm_packs_epi16(dead_low, dead_high);
+        return ~uint32_t(_mm_movemask_epi8(dead)) & 0xffff;
+      }
+#endif
+      uint32_t mask = 0;
+      for (std::size_t i = 0; i < LIVE_SCAN_WIDTH; i++) {
+        if (counts[i].load(std::memory_order_relaxed) != 0) {
+          mask |= uint32_t(1) << i;
+        }
+      }
+      return mask;
+    }
+
+  }
+}
+
+#endif
@@ -0,0 +1,259 @@
+#ifndef CPIOO_MANAGED_ARRAY_HPP
+#define CPIOO_MANAGED_ARRAY_HPP
+
+#include <cpioo/managed_entity.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <optional>
+#include <span>
+#include <utility>
+
+namespace cpioo {
+  namespace managed_entity {
+
+    // Storage for one immutable array of up to CAPACITY elements: a
+    // length header followed by the elements. Every size class of a
+    // managed_array is a `storage` of one of these.
+    template <class T, typename LENGTH_TYPE, std::size_t CAPACITY>
+    class array_slab {
+      LENGTH_TYPE d_length;
+      alignas(T) std::byte d_elements[CAPACITY * sizeof(T)];
+
+      T* elements() {
+        return std::launder(reinterpret_cast<T*>(d_elements));
+      }
+
+    public:
+      explicit array_slab(std::span<const T> items)
+        : d_length(LENGTH_TYPE(items.size())) {
+        std::uninitialized_copy_n(items.data(), items.size(), elements());
+      }
+
+      // Slabs are only ever constructed in place in their storage.
+      array_slab(array_slab&&) = delete;
+      array_slab(const array_slab&) = delete;
+      array_slab& operator=(const array_slab&) = delete;
+      array_slab& operator=(array_slab&&) = delete;
+
+      ~array_slab() {
+        std::destroy_n(elements(), d_length);
+      }
+
+      const T* data() const {
+        return std::launder(reinterpret_cast<const T*>(d_elements));
+      }
+
+      LENGTH_TYPE size() const {
+        return d_length;
+      }
+    };
+
+    // Reference to an immutable array in a managed_array. Behaves like
+    // `reference`, but dereferences to a span of the elements.
+    template <class ARRAY_STORAGE>
+    class array_reference {
+      using element_type = typename ARRAY_STORAGE::element_type;
+      using index_type = typename ARRAY_STORAGE::index_type;
+
+      // Null only for a moved-from reference.
+      const element_type* d_data;
+      index_type d_length;
+      index_type d_index;
+      std::uint8_t d_size_class;
+
+    public:
+      array_reference(std::uint8_t size_class, index_type index,
+                      const element_type* data, index_type length)
+        : d_data(data), d_length(length), d_index(index),
+          d_size_class(size_class) {
+        ARRAY_STORAGE::refcnt_add(d_size_class, d_index);
+      }
+
+      array_reference(const array_reference& other)
+        : d_data(other.d_data), d_length(other.d_length),
+          d_index(other.d_index), d_size_class(other.d_size_class) {
+        ARRAY_STORAGE::refcnt_add(d_size_class, d_index);
+      }
+
+      array_reference(array_reference&& other) noexcept
+        : d_data(other.d_data), d_length(other.d_length),
+          d_index(other.d_index), d_size_class(other.d_size_class) {
+        other.d_data = nullptr;
+      }
+
+      array_reference& operator=(const array_reference& other) = delete;
+      array_reference& operator=(array_reference&& other) noexcept = delete;
+
+      ~array_reference() {
+        if (d_data != nullptr) {
+          ARRAY_STORAGE::refcnt_subtract(d_size_class, d_index);
+        }
+      }
+
+      bool operator==(const array_reference& other) const {
+        return d_data == other.d_data;
+      }
+
+      bool operator!=(const array_reference& other) const {
+        return d_data != other.d_data;
+      }
+
+      std::span<const element_type> operator*() const {
+        return {d_data, std::size_t(d_length)};
+      }
+
+      const element_type& operator[](std::size_t i) const {
+        return d_data[i];
+      }
+
+      const element_type* data() const {
+        return d_data;
+      }
+
+      std::size_t size() const {
+        return d_length;
+      }
+
+      const element_type* begin() const {
+        return d_data;
+      }
+
+      const element_type* end() const {
+        return d_data + d_length;
+      }
+
+      std::uint8_t size_class() const {
+        return d_size_class;
+      }
+
+      index_type index() const {
+        return d_index;
+      }
+    };
+
+    // Variable-length immutable arrays kept in the inside-out storage
+    // instead of on the general heap.
+    //
+    // Arrays are rounded up to a power-of-two size class, from
+    // 2^MIN_CAPACITY_BITS elements up to SIZE_CLASSES classes, and each
+    // class is a regular `storage` of array_slab, so arrays get the
+    // same buffers, refcounts and free-slot reuse as any other entity.
+    // A freed array always leaves a hole that fits the next array of
+    // its class.
+    template <
+      class T,
+      std::size_t SIZE_CLASSES = 8,
+      std::size_t MIN_CAPACITY_BITS = 2,
+      std::size_t BUFFER_SIZE_BITS = 10,
+      typename INDEX_TYPE = uint32_t
+      >
+    class managed_array {
+    public:
+      using element_type = T;
+      using index_type = INDEX_TYPE;
+      using ref_type = array_reference<managed_array>;
+
+      template <std::size_t SIZE_CLASS>
+      static constexpr std::size_t class_capacity =
+        std::size_t(1) << (MIN_CAPACITY_BITS + SIZE_CLASS);
+
+      template <std::size_t SIZE_CLASS>
+      using slab = array_slab<T, INDEX_TYPE, class_capacity<SIZE_CLASS>>;
+
+      template <std::size_t SIZE_CLASS>
+      using class_storage = storage<slab<SIZE_CLASS>, BUFFER_SIZE_BITS, INDEX_TYPE>;
+
+      static constexpr std::size_t MAX_LENGTH = class_capacity<SIZE_CLASSES - 1>;
+
+    private:
+      using refcnt_fn = void (*)(INDEX_TYPE);
+
+      template <std::size_t... SIZE_CLASS>
+      static constexpr std::array<refcnt_fn, SIZE_CLASSES>
+      refcnt_add_table(std::index_sequence<SIZE_CLASS...>) {
+        return {&class_storage<SIZE_CLASS>::refcnt_add...};
+      }
+
+      template <std::size_t... SIZE_CLASS>
+      static constexpr std::array<refcnt_fn, SIZE_CLASSES>
+      refcnt_subtract_table(std::index_sequence<SIZE_CLASS...>) {
+        return {&class_storage<SIZE_CLASS>::refcnt_subtract...};
+      }
+
+      static constexpr std::array<refcnt_fn, SIZE_CLASSES> s_refcnt_add =
+        refcnt_add_table(std::make_index_sequence<SIZE_CLASSES>());
+      static constexpr std::array<refcnt_fn, SIZE_CLASSES> s_refcnt_subtract =
+        refcnt_subtract_table(std::make_index_sequence<SIZE_CLASSES>());
+
+      template <std::size_t SIZE_CLASS>
+      inline static ref_type make_array_in_class(std::span<const T> items) {
+        auto entity = class_storage<SIZE_CLASS>::make_entity(items);
+        return ref_type(SIZE_CLASS, entity.index(), entity->data(), entity->size());
+      }
+
+      template <std::size_t... SIZE_CLASS>
+      inline static ref_type make_array_in_class(std::size_t size_class,
+                                                 std::span<const T> items,
+                                                 std::index_sequence<SIZE_CLASS...>) {
+        std::optional<ref_type> result;
+        ((SIZE_CLASS == size_class
+          ? (void)result.emplace(make_array_in_class<SIZE_CLASS>(items))
+          : (void)0), ...);
+        return std::move(*result);
+      }
+
+    public:
+
+      managed_array() = default;
+
+      // Smallest size class that holds `length` elements.
+      inline static std::size_t size_class_of(std::size_t length) {
+        std::size_t size_class = 0;
+        while (class_capacity<0> << size_class < length) {
+          size_class++;
+        }
+        return size_class;
+      }
+
+      inline static ref_type make_array(std::span<const T> items) {
+        if (items.size() > MAX_LENGTH) {
+          std::cerr << "Array too long for the largest size class." << std::endl;
+          std::abort();
+        }
+        return make_array_in_class(size_class_of(items.size()), items,
+                                   std::make_index_sequence<SIZE_CLASSES>());
+      }
+
+      inline static ref_type make_array(std::initializer_list<T> items) {
+        return make_array(std::span<const T>(items.begin(), items.size()));
+      }
+
+      inline static void refcnt_add(std::uint8_t size_class, INDEX_TYPE index) {
+        s_refcnt_add[size_class](index);
+      }
+
+      inline static void refcnt_subtract(std::uint8_t size_class, INDEX_TYPE index) {
+        s_refcnt_subtract[size_class](index);
+      }
+
+      inline static std::size_t return_free_pool_to_global() {
+        return return_free_pools(std::make_index_sequence<SIZE_CLASSES>());
+      }
+
+    private:
+      template <std::size_t... SIZE_CLASS>
+      inline static std::size_t return_free_pools(std::index_sequence<SIZE_CLASS...>) {
+        return (class_storage<SIZE_CLASS>::return_free_pool_to_global() + ...);
+      }
+    };
+
+  }
+}
+
+#endif
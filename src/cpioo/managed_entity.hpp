@@ -3,6 +3,9 @@
 
 #include <cpioo/version.hpp>
 #include <cpioo/thread_safe_queue.hpp>
+#include <cpioo/buffer_directory.hpp>
+#include <cpioo/live_scan.hpp>
+#include <cpioo/free_pools.hpp>
 #include <optional>
 
 #include <type_traits>
@@ -18,6 +21,10 @@
 #include <atomic>
 #include <thread>
 #include <chrono>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <algorithm>
 
 namespace cpioo {
   namespace managed_entity {
@@ -64,17 +71,43 @@ namespace cpioo {
       const typename STORAGE::type* operator->() const {
         return d_ptr.value();
       }
+
+      const typename STORAGE::type& operator*() const {
+        return *d_ptr.value();
+      }
+
+      // Raw pointer to the referenced object. It stays valid for as
+      // long as this reference (or any other one to the same object)
+      // is alive.
+      const typename STORAGE::type* get() const {
+        return d_ptr.value();
+      }
+
+      // Slot of the referenced object in STORAGE.
+      typename STORAGE::index_type index() const {
+        return d_index;
+      }
     };
 
     constexpr size_t buffer_count(int buffer_size_bits) {
       return 1 << buffer_size_bits;
     }
 
+    // How many buffers a storage can index. Indices past 2^48 could
+    // never be backed by memory, so wider index types stop there.
     template <typename INDEX_TYPE>
     constexpr size_t superbuffer_count(size_t buffer_size_bits) {
-      return std::numeric_limits<INDEX_TYPE>::max() >> buffer_size_bits;
+      size_t max_index = std::numeric_limits<INDEX_TYPE>::max();
+      size_t addressable = (size_t(1) << 48) - 1;
+      return (max_index < addressable ? max_index : addressable) >> buffer_size_bits;
     }
       
+    // Access to a storage's private free slot bookkeeping. Only
+    // declared here: tests define it to set up states that otherwise
+    // take a race between threads.
+    template <class STORAGE>
+    struct free_slots_test_access;
+
     template <
       class T,
       std::size_t BUFFER_SIZE_BITS = 10,
@@ -92,68 +125,554 @@ namespace cpioo {
         >
       >
     class storage {
+      template <class> friend struct free_slots_test_access;
+
     public:
       using refcntbuffer =
         std::array<std::atomic<REFCNT_TYPE>, BUFFER_COUNT >;
-      using refcntsuperbuffer = std::array<refcntbuffer*, SUPERBUFFER_COUNT>;
-      
       using buffer = std::array<T, BUFFER_COUNT>;
-      using superbuffer = std::array<buffer*, SUPERBUFFER_COUNT>;
 
       using type = T;
       using ref_type = reference<storage>;
       using index_type = INDEX_TYPE;
 
+      // Geometry of the storage, for anything that keeps per-entity
+      // data next to it (see side_table).
+      static constexpr std::size_t BUFFER_BITS = BUFFER_SIZE_BITS;
+      static constexpr std::size_t SLOTS_PER_BUFFER = BUFFER_COUNT;
+      static constexpr std::size_t MAX_BUFFERS = SUPERBUFFER_COUNT + 1;
+
+      // Called with the index of every released entity, after it was
+      // destroyed and before its slot can be reused.
+      using release_listener = void (*)(void* context, INDEX_TYPE index);
+      static constexpr std::size_t MAX_RELEASE_LISTENERS = 8;
+
+      // Free slots are tracked per locality block: a whole buffer, or
+      // a 1024-slot run of a larger buffer. Blocks are the unit free
+      // slots move between threads in, and what allocation hints
+      // select, so they must be small enough to mean "nearby".
+      static constexpr std::size_t LOCALITY_BLOCK_BITS =
+        BUFFER_SIZE_BITS < 10 ? BUFFER_SIZE_BITS : 10;
+
+      // When a thread has more free slots cached than the high
+      // watermark, it hands its highest blocks over until it is down
+      // to the low one, so a thread that releases far more than it
+      // allocates doesn't sit on the memory.
+      static constexpr std::size_t FREE_POOL_HIGH_WATERMARK =
+        std::size_t(2) << LOCALITY_BLOCK_BITS;
+      static constexpr std::size_t FREE_POOL_LOW_WATERMARK =
+        std::size_t(1) << LOCALITY_BLOCK_BITS;
+
+      inline static INDEX_TYPE buffer_of(INDEX_TYPE index) {
+        return index >> BUFFER_SIZE_BITS;
+      }
+
+      inline static INDEX_TYPE locality_block_of(INDEX_TYPE index) {
+        return index >> LOCALITY_BLOCK_BITS;
+      }
+
+      // Where a new entity would like to be placed. The allocator
+      // takes a free slot from the hinted block when it has one, or
+      // else the closest block it has free slots in.
+      class locality_hint {
+        INDEX_TYPE d_block;
+
+        // Tagged so a braced T initializer can never be mistaken for
+        // a hint when resolving make_entity overloads.
+        struct from_block {};
+        locality_hint(from_block, INDEX_TYPE block) : d_block(block) {}
+
+      public:
+        // Place the new entity close to an existing one, e.g. its
+        // parent or a sibling.
+        static locality_hint near(const ref_type& other) {
+          return locality_hint(from_block(), locality_block_of(other.index()));
+        }
+
+        // Place the new entity in the given buffer.
+        static locality_hint in_buffer(INDEX_TYPE buffer) {
+          return locality_hint(
+            from_block(), locality_block_of(buffer << BUFFER_SIZE_BITS));
+        }
+
+        INDEX_TYPE block() const {
+          return d_block;
+        }
+      };
+
     private:
+      static constexpr std::size_t FREE_WORDS_PER_BUFFER = (BUFFER_COUNT + 63) / 64;
+      static constexpr std::size_t BLOCK_WORDS =
+        ((std::size_t(1) << LOCALITY_BLOCK_BITS) + 63) / 64;
+      static constexpr std::size_t BLOCKS_PER_BUFFER =
+        std::size_t(1) << (BUFFER_SIZE_BITS - LOCALITY_BLOCK_BITS);
+      static constexpr std::size_t SUMMARY_WORDS =
+        ((SUPERBUFFER_COUNT + 1) * BLOCKS_PER_BUFFER + 63) / 64;
+
+      // How many blocks a thread keeps free slots of before it starts
+      // handing them over to the shared bitmaps.
+      static constexpr std::size_t CACHED_BLOCKS = 4;
+
+    public:
+      // Occupancy bitmap of a buffer, allocated alongside it like the
+      // refcount buffer. A set bit is a free slot no thread has
+      // claimed.
+      using freebuffer =
+        std::array<std::atomic<uint64_t>, FREE_WORDS_PER_BUFFER>;
+
+      // Everything allocated for one buffer. Buffers are numbered
+      // from 0 to SUPERBUFFER_COUNT and found through a
+      // buffer_directory, which only allocates the parts of the index
+      // space in use.
+      struct buffer_slot {
+        buffer* data = nullptr;
+        refcntbuffer* refcnt = nullptr;
+        freebuffer* free = nullptr;
+      };
+      using superbuffer = buffer_directory<buffer_slot, MAX_BUFFERS>;
+
+    private:
+      // The free slots of one block owned by a single thread.
+      struct cached_block {
+        INDEX_TYPE block = 0;
+        size_t count = 0;
+        std::array<uint64_t, BLOCK_WORDS> bits{};
+
+        // Lowest free slot of the block; count must not be zero.
+        INDEX_TYPE take_lowest() {
+          size_t w = 0;
+          while (bits[w] == 0) {
+            w++;
+          }
+          size_t bit = std::countr_zero(bits[w]);
+          bits[w] &= bits[w] - 1;
+          count--;
+          return INDEX_TYPE((size_t(block) << LOCALITY_BLOCK_BITS) + w * 64 + bit);
+        }
+      };
+
+      // Hand free bits of a block over to the shared bitmap of its
+      // buffer, and flag the block in the summary.
+      inline static void donate(INDEX_TYPE block, const uint64_t* bits) {
+        INDEX_TYPE index_in_superbuffer;
+        INDEX_TYPE index_in_buffer;
+        std::tie(index_in_superbuffer, index_in_buffer) =
+          split_index(INDEX_TYPE(size_t(block) << LOCALITY_BLOCK_BITS));
+        freebuffer& fb = *(s_buffers[index_in_superbuffer].free);
+        size_t first_word = index_in_buffer / 64;
+        for (size_t w = 0; w < BLOCK_WORDS; w++) {
+          if (bits[w] != 0) {
+            fb[first_word + w].fetch_or(bits[w], std::memory_order_release);
+          }
+        }
+        size_t word = block / 64;
+        s_free_summary[word].fetch_or(uint64_t(1) << (block % 64));
+        size_t low = s_free_summary_low.load();
+        while (word < low && !s_free_summary_low.compare_exchange_weak(low, word)) {
+        }
+      }
+
+      // Take every free bit of a block out of the shared bitmap.
+      // Returns false if the block had nothing to give.
+      inline static bool claim(INDEX_TYPE block, cached_block& into) {
+        uint64_t flag = uint64_t(1) << (block % 64);
+        if ((s_free_summary[block / 64].fetch_and(~flag, std::memory_order_acq_rel)
+             & flag) == 0) {
+          return false;
+        }
+        INDEX_TYPE index_in_superbuffer;
+        INDEX_TYPE index_in_buffer;
+        std::tie(index_in_superbuffer, index_in_buffer) =
+          split_index(INDEX_TYPE(size_t(block) << LOCALITY_BLOCK_BITS));
+        freebuffer& fb = *(s_buffers[index_in_superbuffer].free);
+        size_t first_word = index_in_buffer / 64;
+        into.block = block;
+        into.count = 0;
+        for (size_t w = 0; w < BLOCK_WORDS; w++) {
+          into.bits[w] = fb[first_word + w].exchange(0, std::memory_order_acquire);
+          into.count += std::popcount(into.bits[w]);
+        }
+        return into.count != 0;
+      }
+
+      inline static bool is_flagged(INDEX_TYPE block) {
+        return s_free_summary[block / 64].load(std::memory_order_relaxed)
+          & (uint64_t(1) << (block % 64));
+      }
+
       // Helper class to store the thread-local free pool and automatically 
       // return it when the thread exits
+      //
+      // Freed slots are set in a small fixed set of per-block bitmaps,
+      // so freeing never allocates here (but see deferred_releases
+      // for destroying long chains). When a slot falls outside the
+      // cached blocks, the highest-addressed block is handed over to
+      // the shared bitmaps, keeping the lowest addresses local.
+      // Allocation always takes the lowest free slot, so the live set
+      // stays packed at the bottom of the buffers.
+      //
+      // The cache is trimmed at the watermarks, dropped whenever
+      // free_pools::request_return was called since the thread last
+      // looked, and registered with free_pools so an idle worker can
+      // drop it with return_on_this_thread.
       struct ThreadFreePoolManager {
-        std::queue<INDEX_TYPE> available_indices;
-        
-        ThreadFreePoolManager() = default;
+        std::array<cached_block, CACHED_BLOCKS> blocks;
+
+        // Slots handed to the shared bitmaps since the last
+        // return_free_pool_to_global.
+        size_t donated = 0;
+
+        uint64_t seen_return_epoch;
+
+        // Generation of the storage's buffers the cached slots belong
+        // to; see reset_buffers.
+        uint64_t seen_generation;
+
+        ThreadFreePoolManager()
+          : seen_return_epoch(free_pools::s_return_epoch.load(std::memory_order_relaxed)),
+            seen_generation(s_generation.load(std::memory_order_acquire)) {
+          free_pools::add_thread_pool(this, &flush_pool);
+        }
+
+        ThreadFreePoolManager(const ThreadFreePoolManager&) = delete;
+        ThreadFreePoolManager& operator=(const ThreadFreePoolManager&) = delete;
+
+        static size_t flush_pool(void* pool) {
+          return static_cast<ThreadFreePoolManager*>(pool)->flush_all();
+        }
+
+        // Forget the cached slots if the buffers they are in were
+        // reset since last time: they are gone, so there is nothing to
+        // hand back.
+        void check_generation() {
+          uint64_t generation = s_generation.load(std::memory_order_acquire);
+          if (generation != seen_generation) {
+            seen_generation = generation;
+            for (auto& c : blocks) {
+              c.count = 0;
+            }
+            donated = 0;
+          }
+        }
+
+        // Drop the cache if a return was requested since last time.
+        void check_return_requested() {
+          check_generation();
+          uint64_t epoch = free_pools::s_return_epoch.load(std::memory_order_relaxed);
+          if (epoch != seen_return_epoch) {
+            seen_return_epoch = epoch;
+            for (auto& c : blocks) {
+              flush(c);
+            }
+          }
+        }
+
+        // Hand over the highest blocks until at the low watermark.
+        void trim() {
+          size_t cached = size();
+          while (cached > FREE_POOL_LOW_WATERMARK) {
+            cached_block* highest = nullptr;
+            for (auto& c : blocks) {
+              if (c.count != 0 && (!highest || c.block > highest->block)) {
+                highest = &c;
+              }
+            }
+            cached -= highest->count;
+            flush(*highest);
+          }
+        }
+
+        void flush(cached_block& c) {
+          if (c.count != 0) {
+            donate(c.block, c.bits.data());
+            donated += c.count;
+            c.count = 0;
+          }
+        }
         
         void push(INDEX_TYPE index) {
-          available_indices.push(index);
+          check_return_requested();
+          INDEX_TYPE block = locality_block_of(index);
+          size_t offset = size_t(index) - (size_t(block) << LOCALITY_BLOCK_BITS);
+          uint64_t bit = uint64_t(1) << (offset % 64);
+
+          cached_block* target = nullptr;
+          cached_block* unused = nullptr;
+          cached_block* highest = nullptr;
+          for (auto& c : blocks) {
+            if (c.count == 0) {
+              unused = unused ? unused : &c;
+            } else if (c.block == block) {
+              target = &c;
+              break;
+            } else if (!highest || c.block > highest->block) {
+              highest = &c;
+            }
+          }
+
+          if (!target) {
+            if (!unused && highest->block < block) {
+              // Every cached block is lower, give this slot away.
+              std::array<uint64_t, BLOCK_WORDS> single{};
+              single[offset / 64] = bit;
+              donate(block, single.data());
+              donated++;
+              return;
+            }
+            if (!unused) {
+              flush(*highest);
+              unused = highest;
+            }
+            target = unused;
+            target->block = block;
+            target->bits.fill(0);
+          }
+          target->bits[offset / 64] |= bit;
+          target->count++;
+          if (size() > FREE_POOL_HIGH_WATERMARK) {
+            trim();
+          }
         }
-        
-        bool empty() const {
-          return available_indices.empty();
+
+        // Take a free slot: from the preferred block if possible,
+        // otherwise the closest cached block, otherwise the lowest
+        // block in the shared bitmaps.
+        std::optional<INDEX_TYPE> pop(std::optional<INDEX_TYPE> preferred_block) {
+          check_return_requested();
+          cached_block* best = nullptr;
+          for (auto& c : blocks) {
+            if (c.count == 0) {
+              continue;
+            }
+            if (!best) {
+              best = &c;
+            } else if (preferred_block.has_value()) {
+              auto distance = [&](INDEX_TYPE b) {
+                return b > *preferred_block ? b - *preferred_block : *preferred_block - b;
+              };
+              if (distance(c.block) < distance(best->block)) {
+                best = &c;
+              }
+            } else if (c.block < best->block) {
+              best = &c;
+            }
+          }
+
+          // A hint past the last buffer has nothing to claim.
+          if (preferred_block.has_value() &&
+              size_t(*preferred_block) >= (size_t(s_elements_capacity.load()) >> LOCALITY_BLOCK_BITS)) {
+            preferred_block.reset();
+          }
+
+          // The flag may be gone by the time we claim the block, or
+          // another thread may have taken its slots in between, so
+          // the claim can fail. best is left alone for that case.
+          if (preferred_block.has_value() &&
+              (!best || best->block != *preferred_block) &&
+              is_flagged(*preferred_block)) {
+            cached_block& into = unused(best);
+            if (claim(*preferred_block, into)) {
+              return into.take_lowest();
+            }
+          }
+
+          if (best) {
+            return best->take_lowest();
+          }
+
+          // Nothing cached, scan the summary for the lowest block with
+          // free slots, starting from the lowest word that may have
+          // one.
+          cached_block& into = unused(nullptr);
+          size_t blocks_in_use = size_t(s_elements_capacity.load()) >> LOCALITY_BLOCK_BITS;
+          size_t summary_words = (blocks_in_use + 63) / 64;
+          for (size_t w = s_free_summary_low.load(); w < summary_words; w++) {
+            uint64_t flags = s_free_summary[w].load(std::memory_order_relaxed);
+            while (flags != 0) {
+              INDEX_TYPE block = INDEX_TYPE(w * 64 + std::countr_zero(flags));
+              flags &= flags - 1;
+              if (claim(block, into)) {
+                return into.take_lowest();
+              }
+            }
+            skip_summary_word(w);
+          }
+          return std::nullopt;
         }
-        
-        INDEX_TYPE front() const {
-          return available_indices.front();
+
+        // Move the summary cursor past a word found empty. A block
+        // donated meanwhile may have seen the cursor still at w and
+        // left it there, so look at the word again once past it.
+        static void skip_summary_word(size_t w) {
+          size_t expected = w;
+          if (!s_free_summary_low.compare_exchange_strong(expected, w + 1) ||
+              s_free_summary[w].load() == 0) {
+            return;
+          }
+          size_t low = w + 1;
+          while (w < low && !s_free_summary_low.compare_exchange_weak(low, w)) {
+          }
         }
-        
-        void pop() {
-          available_indices.pop();
+
+        // A cached block with no slots in it, for claim() to fill.
+        // If every block has slots, the highest one other than keep
+        // is handed over to make room.
+        cached_block& unused(const cached_block* keep) {
+          cached_block* highest = nullptr;
+          for (auto& c : blocks) {
+            if (c.count == 0) {
+              return c;
+            }
+            if (&c != keep && (!highest || c.block > highest->block)) {
+              highest = &c;
+            }
+          }
+          flush(*highest);
+          return *highest;
         }
         
         size_t size() const {
-          return available_indices.size();
+          size_t count = 0;
+          for (auto& c : blocks) {
+            count += c.count;
+          }
+          return count;
+        }
+
+        // Hand every cached slot to the shared bitmaps, returning how
+        // many slots this thread gave away since the last call.
+        size_t flush_all() {
+          check_generation();
+          for (auto& c : blocks) {
+            flush(c);
+          }
+          size_t count = donated;
+          donated = 0;
+          return count;
         }
         
         ~ThreadFreePoolManager() {
-          // Return any remaining items to the global pool on thread exit
-          if (!available_indices.empty()) {
-            s_globally_available.push(std::move(available_indices));
-          }
+          // Return any remaining items to the shared bitmaps on thread exit
+          flush_all();
+          free_pools::remove_thread_pool(this);
         }
       };
 
       inline static DATA_ALLOCATOR s_data_allocator;
       inline static REFCNT_ALLOCATOR s_refcnt_allocator;
       inline static superbuffer s_buffers;
-      inline static refcntsuperbuffer s_refcntbuffers;
+
+      // One bit per block, set when the block's shared bitmap may have
+      // free slots. Scanned for the lowest such block when a thread
+      // runs out of cached slots.
+      inline static buffer_directory<std::atomic<uint64_t>, SUMMARY_WORDS> s_free_summary;
+
+      // No summary word below this one has a block flagged, so the
+      // scan starts here rather than at the first buffer. Lowered by
+      // donate, raised by the scan past words it found empty.
+      inline static std::atomic<size_t> s_free_summary_low = 0;
 
       // Thread-local manager that handles the free pool for this thread
       inline static thread_local ThreadFreePoolManager s_available_on_thread;
 
-      // Global pool of freed memory from all threads
-      inline static ThreadSafeQueue<std::queue<INDEX_TYPE>> s_globally_available;
-
       inline static std::atomic<INDEX_TYPE> s_elements_reserved = 0;
       inline static std::atomic<INDEX_TYPE> s_elements_capacity = 0;
 
+      // Bumped by reset_buffers, so threads drop the free slots they
+      // cached in the buffers it forgot.
+      inline static std::atomic<uint64_t> s_generation = 0;
+
+      struct release_listener_slot {
+        std::atomic<release_listener> listener = nullptr;
+        std::atomic<void*> context = nullptr;
+      };
+      inline static std::array<release_listener_slot, MAX_RELEASE_LISTENERS> s_release_listeners;
+      inline static std::atomic<std::size_t> s_release_listener_count = 0;
+
+      // Entities whose last reference went away while this thread was
+      // already destroying one of this storage. They are destroyed once
+      // that destructor returns rather than from inside it, so a long
+      // chain of entities is released one link at a time instead of
+      // one stack frame per link.
+      //
+      // When a refcount can hold an index, the pending entities are
+      // chained through their own refcounts, which are free until the
+      // slot is reused, so this never allocates. With narrower
+      // refcounts, such as the default short with 32-bit indices, they
+      // are kept in a vector: releasing a chain allocates the first
+      // time it goes deeper than the vector's capacity so far.
+      static constexpr bool CHAIN_DEFERRED_RELEASES =
+        sizeof(REFCNT_TYPE) >= sizeof(INDEX_TYPE);
+      struct deferred_releases {
+        bool releasing = false;
+        // Last entity deferred, and how many are, when chaining.
+        INDEX_TYPE head = 0;
+        size_t count = 0;
+        std::vector<INDEX_TYPE> pending;
+      };
+      inline static thread_local deferred_releases s_deferred_releases;
+
+      inline static void defer_release(deferred_releases& deferred, INDEX_TYPE index) {
+        if constexpr (CHAIN_DEFERRED_RELEASES) {
+          INDEX_TYPE index_in_superbuffer;
+          INDEX_TYPE index_in_buffer;
+          std::tie(index_in_superbuffer, index_in_buffer) =
+            split_index(index);
+          (*(s_buffers[index_in_superbuffer].refcnt))[index_in_buffer]
+            .store(REFCNT_TYPE(deferred.head), std::memory_order_relaxed);
+          deferred.head = index;
+          deferred.count++;
+        } else {
+          deferred.pending.push_back(index);
+        }
+      }
+
+      // Take the last entity deferred, if any.
+      inline static std::optional<INDEX_TYPE> take_deferred(deferred_releases& deferred) {
+        if constexpr (CHAIN_DEFERRED_RELEASES) {
+          if (deferred.count == 0) {
+            return std::nullopt;
+          }
+          INDEX_TYPE index = deferred.head;
+          INDEX_TYPE index_in_superbuffer;
+          INDEX_TYPE index_in_buffer;
+          std::tie(index_in_superbuffer, index_in_buffer) =
+            split_index(index);
+          std::atomic<REFCNT_TYPE>& cell =
+            (*(s_buffers[index_in_superbuffer].refcnt))[index_in_buffer];
+          deferred.head = INDEX_TYPE(cell.load(std::memory_order_relaxed));
+          deferred.count--;
+          cell.store(0, std::memory_order_relaxed);
+          return index;
+        } else {
+          if (deferred.pending.empty()) {
+            return std::nullopt;
+          }
+          INDEX_TYPE index = deferred.pending.back();
+          deferred.pending.pop_back();
+          return index;
+        }
+      }
+
+      // Slots a scan can look at: reserved and backed by a buffer.
+      inline static size_t scan_limit() {
+        size_t capacity = s_elements_capacity.load();
+        size_t reserved = s_elements_reserved.load();
+        return std::min(capacity, reserved);
+      }
+
+      inline static void notify_released(INDEX_TYPE index) {
+        if (s_release_listener_count.load(std::memory_order_acquire) == 0) {
+          return;
+        }
+        for (auto& slot : s_release_listeners) {
+          release_listener listener = slot.listener.load(std::memory_order_acquire);
+          if (listener != nullptr) {
+            listener(slot.context.load(std::memory_order_relaxed), index);
+          }
+        }
+      }
+
       std::tuple<INDEX_TYPE, INDEX_TYPE>
       constexpr static split_index(INDEX_TYPE index) {
         INDEX_TYPE index_in_superbuffer = index >> BUFFER_SIZE_BITS;
@@ -162,20 +681,13 @@ namespace cpioo {
       }
       
       inline static std::tuple<void*, INDEX_TYPE>
-      get_new_storage() {
+      get_new_storage(std::optional<INDEX_TYPE> preferred_block = std::nullopt) {
         // We try to consume any memory already available to this
-        // thread before trying to do anything that would cause a
-        // synchronization requirement.
-        if (s_available_on_thread.empty()) {
-          // Check if there's any globally available memory we can use
-          auto global_queue = s_globally_available.try_pop();
-          if (global_queue) {
-            // Found available memory from another thread
-            s_available_on_thread.available_indices = std::move(*global_queue);
-          }
-        }
+        // thread, and then memory freed by other threads, before
+        // growing the storage.
+        std::optional<INDEX_TYPE> reused = s_available_on_thread.pop(preferred_block);
           
-        if (s_available_on_thread.empty()) {
+        if (!reused.has_value()) {
           // No free memory available, allocate new
           // this will return the index of the desired element
           INDEX_TYPE old_index = s_elements_reserved.load();
@@ -202,9 +714,9 @@ namespace cpioo {
           // first case to do its allocation, and then we can proceed.
           if (index == s_elements_capacity) {
 
-            buffer* bp = s_data_allocator.allocate(1);
-            s_buffers[index_in_superbuffer] = bp;
-            
+            buffer_slot& slot = s_buffers.create(index_in_superbuffer);
+            slot.data = s_data_allocator.allocate(1);
+
             refcntbuffer* rcb =
               new(s_refcnt_allocator.allocate(1)) refcntbuffer;
             for ( auto i = rcb->begin(); i != rcb->end(); i++ ) {
@@ -212,7 +724,14 @@ namespace cpioo {
               *i = 0;
             }
 
-            s_refcntbuffers[index_in_superbuffer] = rcb;
+            slot.refcnt = rcb;
+            slot.free = new freebuffer{};
+
+            size_t first_block = size_t(index) >> LOCALITY_BLOCK_BITS;
+            for (size_t w = first_block / 64;
+                 w <= (first_block + BLOCKS_PER_BUFFER - 1) / 64; w++) {
+              s_free_summary.create(w);
+            }
 
             s_elements_capacity.fetch_add(1<<BUFFER_SIZE_BITS);
 
@@ -222,22 +741,21 @@ namespace cpioo {
             }
           }
 
-          buffer* bp = s_buffers[index_in_superbuffer];
+          buffer* bp = s_buffers[index_in_superbuffer].data;
           void* s = &((*bp)[index_in_buffer]);
           return {
             s,
             index
           };
         } else {
-          // Reuse memory from thread-local pool
-          INDEX_TYPE index = s_available_on_thread.front();
+          // Reuse a free slot
+          INDEX_TYPE index = *reused;
           INDEX_TYPE index_in_superbuffer;
           INDEX_TYPE index_in_buffer;
           std::tie(index_in_superbuffer, index_in_buffer) =
             split_index(index);
-          s_available_on_thread.pop();
           return {
-            &((*(s_buffers[index_in_superbuffer]))[index_in_buffer]),
+            &((*(s_buffers[index_in_superbuffer].data))[index_in_buffer]),
             index
           };
         }
@@ -255,6 +773,34 @@ namespace cpioo {
         return s_elements_capacity;
       }
 
+      // Forget every buffer, and the free slots every thread cached in
+      // them, so the storage starts over empty. For storages whose
+      // buffers live in memory that goes away before the process
+      // does, such as a shm_segment. No entity may be alive, and
+      // nothing may use the storage while this runs.
+      inline static void reset_buffers() {
+        if (for_each_live([](auto, auto) {}) != 0) {
+          std::cerr << "Resetting a storage with live entities." << std::endl;
+          std::abort();
+        }
+        s_generation.fetch_add(1, std::memory_order_release);
+        s_buffers.for_each_entry([](buffer_slot& slot) {
+          if (slot.data != nullptr) {
+            s_data_allocator.deallocate(slot.data, 1);
+            std::destroy_at(slot.refcnt);
+            s_refcnt_allocator.deallocate(slot.refcnt, 1);
+            delete slot.free;
+            slot = buffer_slot{};
+          }
+        });
+        s_free_summary.for_each_entry([](std::atomic<uint64_t>& word) {
+          word.store(0);
+        });
+        s_free_summary_low = 0;
+        s_elements_reserved = 0;
+        s_elements_capacity = 0;
+      }
+
       inline static ref_type make_entity() {
         auto n = get_new_storage();
         type* initialized = new(std::get<0>(n)) T;
@@ -281,40 +827,255 @@ namespace cpioo {
         return ref_type(initialized, std::get<1>(n));
       }
 
+      // Construct the entity directly in its slot. Unlike the braced
+      // overloads above there is no temporary T, so references passed
+      // by rvalue are moved in without touching their refcounts.
+      template <class... ARGS>
+        requires std::is_constructible_v<T, ARGS...>
+      inline static ref_type make_entity(ARGS&&... args) {
+        auto n = get_new_storage();
+        T* initialized = new(std::get<0>(n)) T(std::forward<ARGS>(args)...);
+        return ref_type(initialized, std::get<1>(n));
+      }
+
+      // Same as above, but instead of a ref_type the caller gets the
+      // entity's only count, for reference types that adopt it (see
+      // variant_reference).
+      template <class... ARGS>
+        requires std::is_constructible_v<T, ARGS...>
+      inline static std::tuple<T*, INDEX_TYPE> make_counted_entity(ARGS&&... args) {
+        auto n = get_new_storage();
+        T* initialized = new(std::get<0>(n)) T(std::forward<ARGS>(args)...);
+        INDEX_TYPE index = std::get<1>(n);
+        INDEX_TYPE index_in_superbuffer;
+        INDEX_TYPE index_in_buffer;
+        std::tie(index_in_superbuffer, index_in_buffer) =
+          split_index(index);
+        // No other thread can see the slot yet, so a plain store will do.
+        (*(s_buffers[index_in_superbuffer].refcnt))[index_in_buffer]
+          .store(1, std::memory_order_relaxed);
+        return {initialized, index};
+      }
+
+      inline static ref_type make_entity(locality_hint hint, const T& other) {
+        auto n = get_new_storage(hint.block());
+        T* initialized = new(std::get<0>(n)) T(other);
+        return ref_type(initialized, std::get<1>(n));
+      }
+
+      inline static ref_type make_entity(locality_hint hint, T&& other) {
+        auto n = get_new_storage(hint.block());
+        T* uninitialized = static_cast<T*>(std::get<0>(n));
+        std::uninitialized_move_n(std::addressof(other), 1, uninitialized);
+        return ref_type(uninitialized, std::get<1>(n));
+      }
+
+      template <class... ARGS>
+        requires std::is_constructible_v<T, ARGS...>
+      inline static ref_type make_entity(locality_hint hint, ARGS&&... args) {
+        auto n = get_new_storage(hint.block());
+        T* initialized = new(std::get<0>(n)) T(std::forward<ARGS>(args)...);
+        return ref_type(initialized, std::get<1>(n));
+      }
+
       inline static void refcnt_add(INDEX_TYPE index) {
         INDEX_TYPE index_in_superbuffer;
         INDEX_TYPE index_in_buffer;
         std::tie(index_in_superbuffer, index_in_buffer) =
           split_index(index);
-        (*(s_refcntbuffers[index_in_superbuffer]))[index_in_buffer]
+        (*(s_buffers[index_in_superbuffer].refcnt))[index_in_buffer]
           .fetch_add(1);
       }
       
+      // Destroy the object so the references it holds are released
+      // too, then recycle the slot.
+      inline static void release(INDEX_TYPE index) {
+        INDEX_TYPE index_in_superbuffer;
+        INDEX_TYPE index_in_buffer;
+        std::tie(index_in_superbuffer, index_in_buffer) =
+          split_index(index);
+        std::destroy_at(&((*(s_buffers[index_in_superbuffer].data))[index_in_buffer]));
+        notify_released(index);
+        s_available_on_thread.push(index);
+      }
+
       inline static void refcnt_subtract(INDEX_TYPE index) {
         INDEX_TYPE index_in_superbuffer;
         INDEX_TYPE index_in_buffer;
         std::tie(index_in_superbuffer, index_in_buffer) =
           split_index(index);
         REFCNT_TYPE old =
-          (*(s_refcntbuffers[index_in_superbuffer]))[index_in_buffer].
+          (*(s_buffers[index_in_superbuffer].refcnt))[index_in_buffer].
           fetch_sub(1);
         if (old == 1) {
-          s_available_on_thread.push(index);
+          deferred_releases& deferred = s_deferred_releases;
+          if (deferred.releasing) {
+            defer_release(deferred, index);
+            return;
+          }
+          deferred.releasing = true;
+          release(index);
+          while (auto next = take_deferred(deferred)) {
+            release(*next);
+          }
+          deferred.releasing = false;
         }
       }
 
-      inline static size_t return_free_pool_to_global() {
-        if (s_available_on_thread.empty()) {
-          return 0;
+      // Call f(batch, first_index) for every run of live entities in
+      // the slots [first, last), where batch is a std::span<const T>
+      // of consecutive live entities and first_index the index of the
+      // first one. Dead slots are skipped LIVE_SCAN_WIDTH at a time by
+      // testing their refcounts in bulk. Returns how many entities
+      // were visited.
+      template <class F>
+      inline static size_t for_each_live_in(size_t first, size_t last, F&& f) {
+        size_t visited = 0;
+        while (first < last) {
+          INDEX_TYPE b = buffer_of(INDEX_TYPE(first));
+          size_t buffer_start = size_t(b) << BUFFER_SIZE_BITS;
+          size_t end = std::min(last, buffer_start + BUFFER_COUNT);
+          const buffer_slot& slot = s_buffers[b];
+          const T* data = slot.data->data();
+          const std::atomic<REFCNT_TYPE>* counts = slot.refcnt->data();
+
+          size_t i = first - buffer_start;
+          size_t n = end - buffer_start;
+          size_t run_start = 0;
+          size_t run_length = 0;
+          auto flush = [&]() {
+            if (run_length != 0) {
+              f(std::span<const T>(data + run_start, run_length),
+                INDEX_TYPE(buffer_start + run_start));
+              visited += run_length;
+              run_length = 0;
+            }
+          };
+          auto extend = [&](size_t at, size_t length) {
+            if (run_length != 0 && run_start + run_length != at) {
+              flush();
+            }
+            if (run_length == 0) {
+              run_start = at;
+            }
+            run_length += length;
+          };
+
+          while (i < n) {
+            uint32_t mask;
+            size_t width;
+            if (i + LIVE_SCAN_WIDTH <= n) {
+              mask = live_mask(counts + i);
+              width = LIVE_SCAN_WIDTH;
+            } else {
+              mask = 0;
+              width = n - i;
+              for (size_t k = 0; k < width; k++) {
+                if (counts[i + k].load(std::memory_order_relaxed) != 0) {
+                  mask |= uint32_t(1) << k;
+                }
+              }
+            }
+            // Pairs with the increment that published each entity.
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            // Runs of set bits, lowest first.
+            size_t offset = 0;
+            while (mask != 0) {
+              size_t skip = std::countr_zero(mask);
+              offset += skip;
+              mask >>= skip;
+              size_t length = std::countr_one(mask);
+              extend(i + offset, length);
+              offset += length;
+              mask = length >= 32 ? 0 : mask >> length;
+            }
+            i += width;
+          }
+          flush();
+          first = end;
         }
-        
-        size_t count = s_available_on_thread.size();
-        s_globally_available.push(std::move(s_available_on_thread.available_indices));
-        
-        // Create a new empty queue for this thread
-        s_available_on_thread.available_indices = std::queue<INDEX_TYPE>();
-        
-        return count;
+        return visited;
+      }
+
+      // Call f(batch, first_index) for every run of live entities in
+      // the storage, in index order. See for_each_live_in.
+      //
+      // Entities made or released while the scan runs may or may not
+      // be visited. Nothing keeps the visited entities alive, so the
+      // scan must not overlap with the release of anything it could
+      // visit, e.g. run it while the producer is between frames.
+      template <class F>
+      inline static size_t for_each_live(F&& f) {
+        return for_each_live_in(0, scan_limit(), f);
+      }
+
+      // Same as for_each_live, with the storage split in chunks of
+      // slots handed out to `threads` threads (the calling one among
+      // them). f is called concurrently, and batches arrive in no
+      // particular order.
+      template <class F>
+      inline static size_t parallel_for_each_live(
+        F&& f, size_t threads = std::thread::hardware_concurrency()) {
+        constexpr size_t CHUNK = size_t(1) << LOCALITY_BLOCK_BITS;
+        size_t limit = scan_limit();
+        size_t chunks = (limit + CHUNK - 1) / CHUNK;
+        threads = std::clamp<size_t>(threads, 1, std::max<size_t>(chunks, 1));
+
+        std::atomic<size_t> next_chunk = 0;
+        std::atomic<size_t> visited = 0;
+        auto worker = [&]() {
+          size_t count = 0;
+          for (size_t c = next_chunk++; c < chunks; c = next_chunk++) {
+            count += for_each_live_in(c * CHUNK, std::min(limit, (c + 1) * CHUNK), f);
+          }
+          visited += count;
+        };
+
+        std::vector<std::thread> helpers;
+        for (size_t t = 1; t < threads; t++) {
+          helpers.emplace_back(worker);
+        }
+        worker();
+        for (auto& helper : helpers) {
+          helper.join();
+        }
+        return visited;
+      }
+
+      // Register a listener for released entities, identified by its
+      // non-null context. Returns false when all MAX_RELEASE_LISTENERS
+      // slots are taken. The listener must stay callable until it is
+      // removed, and must not be removed while entities are being
+      // released on other threads.
+      inline static bool add_release_listener(release_listener listener, void* context) {
+        for (auto& slot : s_release_listeners) {
+          void* expected = nullptr;
+          if (slot.context.compare_exchange_strong(expected, context)) {
+            slot.listener.store(listener, std::memory_order_release);
+            s_release_listener_count++;
+            return true;
+          }
+        }
+        return false;
+      }
+
+      inline static void remove_release_listener(void* context) {
+        for (auto& slot : s_release_listeners) {
+          if (slot.context.load() == context) {
+            slot.listener.store(nullptr, std::memory_order_release);
+            slot.context.store(nullptr);
+            s_release_listener_count--;
+            return;
+          }
+        }
+      }
+
+      // Hand this thread's free slots to the shared bitmaps. Returns
+      // how many slots this thread made available to other threads
+      // since the last call.
+      inline static size_t return_free_pool_to_global() {
+        return s_available_on_thread.flush_all();
       }
 
     };
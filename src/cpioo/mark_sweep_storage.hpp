@@ -0,0 +1,414 @@
+#ifndef CPIOO_MARK_SWEEP_STORAGE_HPP
+#define CPIOO_MARK_SWEEP_STORAGE_HPP
+
+#include <cpioo/managed_entity.hpp>
+#include <cpioo/buffer_directory.hpp>
+#include <cpioo/free_pools.hpp>
+#include <cpioo/thread_safe_queue.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace cpioo {
+  namespace managed_entity {
+
+    // dead[w] = allocated[w] & ~marked[w], then allocated[w] keeps
+    // only the marked slots, for the first `words` words. Returns
+    // whether any slot is dead. Two words at a time with SSE2.
+    inline bool sweep_bitmap_words(uint64_t* allocated, const uint64_t* marked,
+                                   uint64_t* dead, std::size_t words) {
+      std::size_t w = 0;
+      uint64_t any_dead = 0;
+#if defined(__SSE2__)
+      __m128i any = _mm_setzero_si128();
+      for (; w + 2 <= words; w += 2) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(allocated + w));
+        __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(marked + w));
+        __m128i d = _mm_andnot_si128(m, a);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dead + w), d);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(allocated + w), _mm_and_si128(a, m));
+        any = _mm_or_si128(any, d);
+      }
+      any_dead = _mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xffff;
+#endif
+      for (; w < words; w++) {
+        dead[w] = allocated[w] & ~marked[w];
+        allocated[w] &= marked[w];
+        any_dead |= dead[w];
+      }
+      return any_dead != 0;
+    }
+
+    // Marks a reference found while tracing an object. References
+    // into storages that are not traced (e.g. a refcounted storage)
+    // end the trace there: those objects are kept alive by their own
+    // reference counts.
+    template <class STORAGE>
+    void mark_reference(const reference<STORAGE>& ref) {
+      if constexpr (requires { STORAGE::mark(ref); }) {
+        STORAGE::mark(ref);
+      }
+    }
+
+    template <class STORAGE>
+    void mark_reference(const std::optional<reference<STORAGE>>& ref) {
+      if (ref.has_value()) {
+        mark_reference(*ref);
+      }
+    }
+
+    // Reclamation by tracing instead of reference counting.
+    //
+    // This is a drop-in alternative to `storage` for frame-oriented
+    // workloads: the same `reference` type works with it, but
+    // refcnt_add and refcnt_subtract are no-ops, so copying or
+    // dropping a reference is a plain load and store.
+    //
+    // Instead of a refcount buffer, every data buffer has a mark
+    // buffer next to it holding two bitmaps: which slots are
+    // allocated and which were reached in the current collection.
+    // Slots are reclaimed by collect(), which marks everything
+    // reachable from the live frame roots and then sweeps the
+    // bitmaps word by word, destroying unreached objects and
+    // rebuilding the free lists in bulk.
+    //
+    // T must provide, findable through ADL,
+    //
+    //   template <class F> void trace_references(const T&, F&& mark);
+    //
+    // calling `mark(r)` for every reference (or optional reference)
+    // it holds.
+    //
+    // collect() must not run concurrently with make_entity on this
+    // storage, and every reference any thread is still using must be
+    // reachable from the roots it is given.
+    template <
+      class T,
+      std::size_t BUFFER_SIZE_BITS = 10,
+      typename INDEX_TYPE = uint32_t,
+      std::size_t SUPERBUFFER_COUNT = superbuffer_count<INDEX_TYPE>(BUFFER_SIZE_BITS),
+      std::size_t BUFFER_COUNT = buffer_count(BUFFER_SIZE_BITS),
+      class DATA_ALLOCATOR = std::allocator<
+        std::array<T, BUFFER_COUNT >
+        >
+      >
+    class mark_sweep_storage {
+    public:
+      static constexpr std::size_t BITMAP_WORDS = (BUFFER_COUNT + 63) / 64;
+
+      using bitmap = std::array<uint64_t, BITMAP_WORDS>;
+      struct markbuffer {
+        bitmap allocated;
+        bitmap marked;
+      };
+      using buffer = std::array<T, BUFFER_COUNT>;
+
+      struct buffer_slot {
+        buffer* data = nullptr;
+        markbuffer* marks = nullptr;
+      };
+      using superbuffer = buffer_directory<buffer_slot, SUPERBUFFER_COUNT + 1>;
+
+      using type = T;
+      using ref_type = reference<mark_sweep_storage>;
+      using index_type = INDEX_TYPE;
+
+    private:
+      // Words swept between checks for dead objects. Small enough to
+      // keep the dead bitmap on the stack, large enough to amortize
+      // the check.
+      static constexpr std::size_t SWEEP_CHUNK_WORDS =
+        BITMAP_WORDS < 64 ? BITMAP_WORDS : 64;
+
+      // Helper class to store the thread-local free list and
+      // automatically return it when the thread exits, or when an
+      // idle worker calls free_pools::return_on_this_thread.
+      struct ThreadFreeListManager {
+        std::vector<INDEX_TYPE> available_indices;
+
+        ThreadFreeListManager() {
+          free_pools::add_thread_pool(this, &flush_pool);
+        }
+
+        ThreadFreeListManager(const ThreadFreeListManager&) = delete;
+        ThreadFreeListManager& operator=(const ThreadFreeListManager&) = delete;
+
+        static size_t flush_pool(void* pool) {
+          return static_cast<ThreadFreeListManager*>(pool)->flush();
+        }
+
+        size_t flush() {
+          size_t count = available_indices.size();
+          if (count != 0) {
+            s_globally_available.push(std::move(available_indices));
+            available_indices = std::vector<INDEX_TYPE>();
+          }
+          return count;
+        }
+
+        ~ThreadFreeListManager() {
+          flush();
+          free_pools::remove_thread_pool(this);
+        }
+      };
+
+      inline static DATA_ALLOCATOR s_data_allocator;
+      inline static superbuffer s_buffers;
+
+      inline static thread_local ThreadFreeListManager s_available_on_thread;
+
+      // Objects marked but not traced yet. Tracing an object found
+      // while another is being traced waits its turn on the stack.
+      struct mark_stack {
+        bool tracing = false;
+        std::vector<const T*> pending;
+      };
+      inline static thread_local mark_stack s_mark_stack;
+
+      // Free lists rebuilt by the sweep, one batch per buffer
+      inline static ThreadSafeQueue<std::vector<INDEX_TYPE>> s_globally_available;
+
+      inline static std::atomic<INDEX_TYPE> s_elements_reserved = 0;
+      inline static std::atomic<INDEX_TYPE> s_elements_capacity = 0;
+
+      std::tuple<INDEX_TYPE, INDEX_TYPE>
+      constexpr static split_index(INDEX_TYPE index) {
+        INDEX_TYPE index_in_superbuffer = index >> BUFFER_SIZE_BITS;
+        INDEX_TYPE index_in_buffer = index & ((1 << BUFFER_SIZE_BITS)-1);
+        return {index_in_superbuffer, index_in_buffer};
+      }
+
+      inline static std::tuple<void*, INDEX_TYPE>
+      get_new_storage() {
+        auto& available = s_available_on_thread.available_indices;
+        if (available.empty()) {
+          auto global_list = s_globally_available.try_pop();
+          if (global_list) {
+            available = std::move(*global_list);
+          }
+        }
+
+        INDEX_TYPE index;
+        if (available.empty()) {
+          INDEX_TYPE old_index = s_elements_reserved.load();
+          index = s_elements_reserved.fetch_add(1);
+          if (index < old_index) {
+            std::cerr << "Ran out of memory." << std::endl;
+            std::abort();
+          }
+          INDEX_TYPE index_in_superbuffer = std::get<0>(split_index(index));
+
+          // Same growth protocol as storage: whoever reserves the
+          // first index past the capacity allocates the next buffer,
+          // everyone past that waits for it.
+          if (index == s_elements_capacity) {
+            buffer_slot& slot = s_buffers.create(index_in_superbuffer);
+            slot.data = s_data_allocator.allocate(1);
+            slot.marks = new markbuffer{};
+            s_elements_capacity.fetch_add(1<<BUFFER_SIZE_BITS);
+          } else {
+            while (index > s_elements_capacity) {
+              std::this_thread::yield();
+            }
+          }
+        } else {
+          index = available.back();
+          available.pop_back();
+        }
+
+        INDEX_TYPE index_in_superbuffer;
+        INDEX_TYPE index_in_buffer;
+        std::tie(index_in_superbuffer, index_in_buffer) =
+          split_index(index);
+        std::atomic_ref<uint64_t>(
+          s_buffers[index_in_superbuffer].marks->allocated[index_in_buffer / 64])
+          .fetch_or(uint64_t(1) << (index_in_buffer % 64), std::memory_order_relaxed);
+        return {
+          &((*(s_buffers[index_in_superbuffer].data))[index_in_buffer]),
+          index
+        };
+      }
+
+      inline static INDEX_TYPE buffers_in_use() {
+        return s_elements_capacity >> BUFFER_SIZE_BITS;
+      }
+
+      // Bitmap words of buffer b that cover reserved slots. Slots past
+      // the reservation were never allocated, so collections skip
+      // them; this matters for large buffers that are mostly unused.
+      inline static std::size_t bitmap_words_in_use(INDEX_TYPE b) {
+        std::size_t first = std::size_t(b) << BUFFER_SIZE_BITS;
+        std::size_t reserved = s_elements_reserved;
+        if (reserved <= first) {
+          return 0;
+        }
+        std::size_t words = (reserved - first + 63) / 64;
+        return words < BITMAP_WORDS ? words : BITMAP_WORDS;
+      }
+
+    public:
+
+      mark_sweep_storage() = default;
+
+      inline static INDEX_TYPE get_elements_reserved() {
+        return s_elements_reserved;
+      }
+
+      inline static INDEX_TYPE get_elements_capacity() {
+        return s_elements_capacity;
+      }
+
+      inline static ref_type make_entity() {
+        auto n = get_new_storage();
+        type* initialized = new(std::get<0>(n)) T;
+        return ref_type(initialized, std::get<1>(n));
+      }
+
+      inline static ref_type make_entity(const T& other) {
+        auto n = get_new_storage();
+        T* initialized = new(std::get<0>(n)) T(other);
+        return ref_type(initialized, std::get<1>(n));
+      }
+
+      inline static ref_type make_entity(T&& other) {
+        auto n = get_new_storage();
+        T* uninitialized = static_cast<T*>(std::get<0>(n));
+        std::uninitialized_move_n(std::addressof(other), 1, uninitialized);
+        return ref_type(uninitialized, std::get<1>(n));
+      }
+
+      inline static ref_type make_entity(std::initializer_list<T> init_list) {
+        auto n = get_new_storage();
+        T* initialized = new(std::get<0>(n)) T(init_list);
+        return ref_type(initialized, std::get<1>(n));
+      }
+
+      template <class... ARGS>
+        requires std::is_constructible_v<T, ARGS...>
+      inline static ref_type make_entity(ARGS&&... args) {
+        auto n = get_new_storage();
+        T* initialized = new(std::get<0>(n)) T(std::forward<ARGS>(args)...);
+        return ref_type(initialized, std::get<1>(n));
+      }
+
+      // References into a traced storage don't own anything.
+      inline static void refcnt_add(INDEX_TYPE) {}
+      inline static void refcnt_subtract(INDEX_TYPE) {}
+
+      // Clear the marks of the previous collection.
+      inline static void begin_collection() {
+        for (INDEX_TYPE b = 0; b < buffers_in_use(); b++) {
+          auto& marked = s_buffers[b].marks->marked;
+          std::fill_n(marked.begin(), bitmap_words_in_use(b), 0);
+        }
+      }
+
+      // Mark the object and, the first time it is reached, everything
+      // reachable from it. Objects are marked when found and traced
+      // later from the mark stack, so deep structures don't recurse.
+      inline static void mark(const ref_type& ref) {
+        INDEX_TYPE index_in_superbuffer;
+        INDEX_TYPE index_in_buffer;
+        std::tie(index_in_superbuffer, index_in_buffer) =
+          split_index(ref.index());
+        uint64_t& word =
+          s_buffers[index_in_superbuffer].marks->marked[index_in_buffer / 64];
+        uint64_t bit = uint64_t(1) << (index_in_buffer % 64);
+        if (word & bit) {
+          return;
+        }
+        word |= bit;
+        mark_stack& stack = s_mark_stack;
+        stack.pending.push_back(ref.get());
+        if (stack.tracing) {
+          return;
+        }
+        stack.tracing = true;
+        while (!stack.pending.empty()) {
+          const T* object = stack.pending.back();
+          stack.pending.pop_back();
+          trace_references(*object, [](const auto& child) {
+            mark_reference(child);
+          });
+        }
+        stack.tracing = false;
+      }
+
+      inline static void mark(const std::optional<ref_type>& ref) {
+        if (ref.has_value()) {
+          mark(*ref);
+        }
+      }
+
+      // Destroy every allocated object that wasn't marked and hand
+      // its slot back to the allocator. Returns how many slots were
+      // reclaimed.
+      inline static size_t sweep() {
+        size_t reclaimed = 0;
+        for (INDEX_TYPE b = 0; b < buffers_in_use(); b++) {
+          markbuffer& mb = *s_buffers[b].marks;
+          buffer& data = *s_buffers[b].data;
+          std::vector<INDEX_TYPE> freed;
+          std::size_t words = bitmap_words_in_use(b);
+          for (std::size_t base = 0; base < words; base += SWEEP_CHUNK_WORDS) {
+            std::size_t chunk = std::min(SWEEP_CHUNK_WORDS, words - base);
+            std::array<uint64_t, SWEEP_CHUNK_WORDS> dead;
+            if (!sweep_bitmap_words(&mb.allocated[base], &mb.marked[base],
+                                    dead.data(), chunk)) {
+              continue;
+            }
+            for (std::size_t w = 0; w < chunk; w++) {
+              uint64_t bits = dead[w];
+              while (bits != 0) {
+                std::size_t index_in_buffer = (base + w) * 64 + std::countr_zero(bits);
+                bits &= bits - 1;
+                std::destroy_at(&data[index_in_buffer]);
+                freed.push_back(
+                  INDEX_TYPE((INDEX_TYPE(b) << BUFFER_SIZE_BITS) | index_in_buffer));
+              }
+            }
+          }
+          if (!freed.empty()) {
+            reclaimed += freed.size();
+            s_globally_available.push(std::move(freed));
+          }
+        }
+        return reclaimed;
+      }
+
+      // A full collection of this storage: everything not reachable
+      // from the given roots (references or optional references) is
+      // reclaimed. When several traced storages reference each other,
+      // call begin_collection on all of them, mark the roots, then
+      // sweep each one instead.
+      template <class... ROOTS>
+      inline static size_t collect(const ROOTS&... roots) {
+        begin_collection();
+        (mark(roots), ...);
+        return sweep();
+      }
+
+      inline static size_t return_free_pool_to_global() {
+        return s_available_on_thread.flush();
+      }
+
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,443 @@
+#ifndef CPIOO_SHM_STORAGE_HPP
+#define CPIOO_SHM_STORAGE_HPP
+
+#include <cpioo/managed_entity.hpp>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cpioo {
+  namespace managed_entity {
+
+    // Storage whose buffers live in a POSIX shared-memory segment, so
+    // other processes can read published frames without copying them.
+    //
+    // The segment is mapped at the same address in every process,
+    // which keeps the pointers inside references valid everywhere.
+    // Only the data buffers are shared: refcounts, free bitmaps and
+    // the buffer directory stay in the writer's private memory, so
+    // readers never write to anything the writer shares and the
+    // writer's refcount traffic never dirties shared pages.
+    //
+    // Readers map the data read-only and must only follow pointers
+    // (operator->, get(), tree_walker), never copy a reference, as
+    // that would touch refcounts that don't exist in their process.
+    // T itself must not point into private memory (no std::vector,
+    // std::string, ...); managed_array and other shm storages are
+    // fine.
+    //
+    // The writer attaches each shm_storage to the segment its buffers
+    // are carved from. Destroying the segment detaches them first,
+    // which forgets their buffers, so every entity of an attached
+    // storage must be released before its segment goes away.
+    //
+    // Frames are kept alive across processes by pinning: a reader
+    // pins the frame it traverses in the segment header, and the
+    // writer's shm_publisher keeps every frame that is the latest or
+    // pinned by some reader. Pins of reader processes that died are
+    // dropped by the writer.
+    class shm_segment {
+    public:
+      static constexpr uint64_t MAGIC = 0x6370696f6f73686dULL;
+      static constexpr std::size_t FRAME_RING = 64;
+      static constexpr std::size_t MAX_READERS = 32;
+      // Where segments are mapped unless told otherwise: far below the
+      // region the kernel hands out mappings from, so the range is
+      // still free when a reader process maps the segment.
+      static constexpr uintptr_t DEFAULT_BASE = 0x7e8000000000;
+
+      struct frame_slot {
+        std::atomic<uint64_t> sequence;
+        std::atomic<uintptr_t> root;
+      };
+
+      struct reader_slot {
+        std::atomic<pid_t> pid;
+        // Sequence of the pinned frame, 0 when nothing is pinned.
+        std::atomic<uint64_t> pinned;
+      };
+
+      // Start of the segment, mapped read-write by every process.
+      struct header {
+        uint64_t magic;
+        uintptr_t base;
+        std::size_t header_size;
+        std::size_t arena_size;
+        std::atomic<std::size_t> arena_used;
+        // Sequence of the latest frame, 0 before the first one.
+        std::atomic<uint64_t> latest;
+        std::array<frame_slot, FRAME_RING> frames;
+        std::array<reader_slot, MAX_READERS> readers;
+      };
+
+      static_assert(std::atomic<uint64_t>::is_always_lock_free);
+      static_assert(std::atomic<pid_t>::is_always_lock_free);
+
+    private:
+      std::string d_name;
+      bool d_owner;
+      header* d_header;
+      std::byte* d_arena;
+      std::size_t d_mapped_size;
+      // Detach functions of the storages attached to the segment.
+      std::vector<void (*)()> d_attached;
+
+      shm_segment(std::string name, bool owner, header* h, std::size_t mapped_size)
+        : d_name(std::move(name)), d_owner(owner), d_header(h),
+          d_arena(reinterpret_cast<std::byte*>(h) + h->header_size),
+          d_mapped_size(mapped_size) {}
+
+      static std::size_t page_round(std::size_t size) {
+        std::size_t page = std::size_t(sysconf(_SC_PAGESIZE));
+        return (size + page - 1) / page * page;
+      }
+
+    public:
+      shm_segment(const shm_segment&) = delete;
+      shm_segment& operator=(const shm_segment&) = delete;
+
+      // Create the segment `name` (as for shm_open) with room for
+      // arena_size bytes of buffers, mapped at `base`. Returns null,
+      // with errno set, on failure, including when `base` is taken.
+      static std::unique_ptr<shm_segment> create(const std::string& name,
+                                                 std::size_t arena_size,
+                                                 uintptr_t base_address = DEFAULT_BASE) {
+        std::size_t header_size = page_round(sizeof(header));
+        arena_size = page_round(arena_size);
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+          return nullptr;
+        }
+        if (ftruncate(fd, off_t(header_size + arena_size)) != 0) {
+          int error = errno;
+          close(fd);
+          shm_unlink(name.c_str());
+          errno = error;
+          return nullptr;
+        }
+        void* base = mmap(reinterpret_cast<void*>(base_address), header_size + arena_size,
+                          PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+          int error = errno;
+          shm_unlink(name.c_str());
+          errno = error;
+          return nullptr;
+        }
+
+        header* h = new(base) header{};
+        h->magic = MAGIC;
+        h->base = uintptr_t(base);
+        h->header_size = header_size;
+        h->arena_size = arena_size;
+
+        return std::unique_ptr<shm_segment>(
+          new shm_segment(name, true, h, header_size + arena_size));
+      }
+
+      // Map an existing segment for reading, at the address the writer
+      // has it at. Returns null, with errno set, if the segment doesn't
+      // exist or that address is taken in this process.
+      static std::unique_ptr<shm_segment> open(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+          return nullptr;
+        }
+        std::size_t header_size = page_round(sizeof(header));
+        void* probe = mmap(nullptr, header_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (probe == MAP_FAILED) {
+          close(fd);
+          return nullptr;
+        }
+        const header* h = static_cast<const header*>(probe);
+        bool valid = h->magic == MAGIC && h->header_size == header_size;
+        void* base = reinterpret_cast<void*>(h->base);
+        std::size_t arena_size = h->arena_size;
+        munmap(probe, header_size);
+        if (!valid) {
+          close(fd);
+          errno = EINVAL;
+          return nullptr;
+        }
+
+        void* mapped_header = mmap(base, header_size, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+        if (mapped_header == MAP_FAILED) {
+          close(fd);
+          return nullptr;
+        }
+        void* arena = mmap(static_cast<std::byte*>(base) + header_size, arena_size,
+                           PROT_READ, MAP_SHARED | MAP_FIXED_NOREPLACE, fd,
+                           off_t(header_size));
+        close(fd);
+        if (arena == MAP_FAILED) {
+          int error = errno;
+          munmap(mapped_header, header_size);
+          errno = error;
+          return nullptr;
+        }
+        return std::unique_ptr<shm_segment>(
+          new shm_segment(name, false, static_cast<header*>(mapped_header),
+                          header_size + arena_size));
+      }
+
+      ~shm_segment() {
+        // Detaching removes the storage from the list.
+        while (!d_attached.empty()) {
+          d_attached.back()();
+        }
+        munmap(d_header, d_mapped_size);
+        if (d_owner) {
+          shm_unlink(d_name.c_str());
+        }
+      }
+
+      // Called by shm_storage::attach and detach.
+      void add_attached(void (*detach)()) {
+        d_attached.push_back(detach);
+      }
+
+      void remove_attached(void (*detach)()) {
+        d_attached.erase(std::remove(d_attached.begin(), d_attached.end(), detach),
+                         d_attached.end());
+      }
+
+      header& get_header() const {
+        return *d_header;
+      }
+
+      bool owner() const {
+        return d_owner;
+      }
+
+      // Carve `size` bytes out of the arena. Memory is never returned:
+      // storages keep their buffers for good.
+      void* allocate(std::size_t size, std::size_t alignment) {
+        std::size_t used = d_header->arena_used.load();
+        std::size_t start;
+        do {
+          start = (used + alignment - 1) / alignment * alignment;
+          if (start + size > d_header->arena_size) {
+            std::cerr << "Shared-memory segment is full." << std::endl;
+            std::abort();
+          }
+        } while (!d_header->arena_used.compare_exchange_weak(used, start + size));
+        return d_arena + start;
+      }
+    };
+
+    // Allocates the buffers of STORAGE from the segment it is
+    // attached to.
+    template <class BUFFER, class STORAGE>
+    struct shm_allocator {
+      using value_type = BUFFER;
+
+      shm_allocator() = default;
+      template <class U>
+      shm_allocator(const shm_allocator<U, STORAGE>&) {}
+
+      BUFFER* allocate(std::size_t n) {
+        shm_segment* segment = STORAGE::segment();
+        if (segment == nullptr) {
+          std::cerr << "Storage is not attached to a shared-memory segment." << std::endl;
+          std::abort();
+        }
+        std::size_t alignment = alignof(BUFFER) < 64 ? 64 : alignof(BUFFER);
+        return static_cast<BUFFER*>(segment->allocate(n * sizeof(BUFFER), alignment));
+      }
+
+      void deallocate(BUFFER*, std::size_t) {}
+    };
+
+    // A storage whose data buffers are carved out of the segment it
+    // is attached to. Entities can only be made while attached.
+    template <
+      class T,
+      std::size_t BUFFER_SIZE_BITS = 10,
+      typename INDEX_TYPE = uint32_t,
+      typename REFCNT_TYPE = short
+      >
+    class shm_storage : public storage<
+      T, BUFFER_SIZE_BITS, INDEX_TYPE,
+      superbuffer_count<INDEX_TYPE>(BUFFER_SIZE_BITS),
+      buffer_count(BUFFER_SIZE_BITS),
+      REFCNT_TYPE,
+      shm_allocator<std::array<T, buffer_count(BUFFER_SIZE_BITS)>, shm_storage<
+                      T, BUFFER_SIZE_BITS, INDEX_TYPE, REFCNT_TYPE>>
+      > {
+      inline static shm_segment* s_segment = nullptr;
+
+    public:
+      // Carve the buffers out of `segment` from now on, detaching from
+      // the previous segment first. Must not run concurrently with
+      // anything else using the storage.
+      static void attach(shm_segment& segment) {
+        if (s_segment == &segment) {
+          return;
+        }
+        detach();
+        s_segment = &segment;
+        segment.add_attached(&detach);
+      }
+
+      // Forget the buffers carved out of the current segment. Every
+      // entity must have been released.
+      static void detach() {
+        if (s_segment == nullptr) {
+          return;
+        }
+        s_segment->remove_attached(&detach);
+        s_segment = nullptr;
+        shm_storage::reset_buffers();
+      }
+
+      static shm_segment* segment() {
+        return s_segment;
+      }
+    };
+
+    // Writer side: publishes frames to the segment and keeps them
+    // alive while readers have them pinned.
+    template <class STORAGE>
+    class shm_publisher {
+    public:
+      using ref_type = typename STORAGE::ref_type;
+
+    private:
+      shm_segment& d_segment;
+      uint64_t d_sequence = 0;
+      std::deque<std::pair<uint64_t, ref_type>> d_held;
+
+      bool pinned(uint64_t sequence) {
+        for (auto& reader : d_segment.get_header().readers) {
+          pid_t pid = reader.pid.load();
+          if (pid == 0) {
+            continue;
+          }
+          if (kill(pid, 0) != 0 && errno == ESRCH) {
+            // The reader died without unpinning.
+            reader.pinned.store(0);
+            reader.pid.store(0);
+            continue;
+          }
+          if (reader.pinned.load() == sequence) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+    public:
+      explicit shm_publisher(shm_segment& segment)
+        : d_segment(segment) {}
+
+      // Make `root` the latest frame, then drop every older frame no
+      // reader has pinned. Returns the frame's sequence number.
+      uint64_t publish(const ref_type& root) {
+        auto& h = d_segment.get_header();
+        uint64_t sequence = ++d_sequence;
+        d_held.emplace_back(sequence, root);
+        auto& slot = h.frames[sequence % shm_segment::FRAME_RING];
+        slot.root.store(uintptr_t(root.get()));
+        slot.sequence.store(sequence);
+        h.latest.store(sequence);
+        release_unpinned();
+        return sequence;
+      }
+
+      // Drop the frames that are neither the latest nor pinned.
+      void release_unpinned() {
+        std::deque<std::pair<uint64_t, ref_type>> kept;
+        while (!d_held.empty()) {
+          if (d_held.front().first == d_sequence || pinned(d_held.front().first)) {
+            kept.emplace_back(std::move(d_held.front()));
+          }
+          d_held.pop_front();
+        }
+        d_held.swap(kept);
+      }
+
+      // How many frames are being kept alive.
+      std::size_t held() const {
+        return d_held.size();
+      }
+    };
+
+    // Reader side: pins and returns the latest frame. One reader per
+    // thread that traverses frames.
+    template <class T>
+    class shm_frame_reader {
+      shm_segment& d_segment;
+      shm_segment::reader_slot* d_slot = nullptr;
+
+    public:
+      explicit shm_frame_reader(shm_segment& segment)
+        : d_segment(segment) {
+        for (auto& slot : d_segment.get_header().readers) {
+          pid_t expected = 0;
+          if (slot.pid.compare_exchange_strong(expected, getpid())) {
+            d_slot = &slot;
+            return;
+          }
+        }
+        std::cerr << "Too many shared-memory readers." << std::endl;
+        std::abort();
+      }
+
+      shm_frame_reader(const shm_frame_reader&) = delete;
+      shm_frame_reader& operator=(const shm_frame_reader&) = delete;
+
+      ~shm_frame_reader() {
+        d_slot->pinned.store(0);
+        d_slot->pid.store(0);
+      }
+
+      // Pin the latest frame, releasing the previously pinned one, and
+      // return its root, or null if nothing was published yet. The
+      // frame stays valid until the next call, unpin, or destruction.
+      const T* pin_latest(uint64_t* sequence = nullptr) {
+        auto& h = d_segment.get_header();
+        for (;;) {
+          uint64_t latest = h.latest.load();
+          if (latest == 0) {
+            return nullptr;
+          }
+          const auto& slot = h.frames[latest % shm_segment::FRAME_RING];
+          uintptr_t root = slot.root.load();
+          d_slot->pinned.store(latest);
+          // If the frame is still the latest after the pin is visible,
+          // the writer will see the pin before it could release it.
+          if (h.latest.load() == latest && slot.sequence.load() == latest) {
+            if (sequence != nullptr) {
+              *sequence = latest;
+            }
+            return reinterpret_cast<const T*>(root);
+          }
+        }
+      }
+
+      void unpin() {
+        d_slot->pinned.store(0);
+      }
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef CPIOO_SIDE_TABLE_HPP
+#define CPIOO_SIDE_TABLE_HPP
+
+#include <cpioo/managed_entity.hpp>
+#include <cpioo/buffer_directory.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <type_traits>
+
+namespace cpioo {
+  namespace managed_entity {
+
+    // An extra, mutable column of per-entity data kept outside of the
+    // entities themselves, the same way the refcounts are: one U per
+    // slot of STORAGE, in columns shaped like its buffers, addressed
+    // by the index of a reference.
+    //
+    // This is meant for data derived from an immutable entity, such as
+    // memoized computations, render handles or dirty flags, that
+    // shouldn't widen T or go in a hash map. Writing a column never
+    // touches T's cache lines.
+    //
+    // A column is allocated the first time an entity of its buffer is
+    // written to through operator[] or at(); find() and get() only
+    // read, and never allocate. Values start as U{} and are reset to
+    // U{} when the entity is released, so a reused slot never sees the
+    // data of the entity that was there before. U must be default
+    // constructible; concurrent access to the same entry needs U to be
+    // safe for it (e.g. an atomic).
+    //
+    // Columns of a trivial U are allocated zeroed rather than
+    // value-initialized entry by entry, so a large column only costs
+    // the pages actually written. U{} is then assumed to be all zero
+    // bytes, as it is for arithmetic, enum and pointer types and
+    // aggregates of them.
+    //
+    // The table registers itself as a release listener of STORAGE, and
+    // must not be destroyed while entities of STORAGE are being
+    // released on other threads.
+    template <class STORAGE, class U>
+    class side_table {
+    public:
+      using ref_type = typename STORAGE::ref_type;
+      using index_type = typename STORAGE::index_type;
+      using value_type = U;
+      using column = std::array<U, STORAGE::SLOTS_PER_BUFFER>;
+
+    private:
+      static constexpr bool ZEROED_COLUMNS =
+        std::is_trivially_default_constructible_v<U> && std::is_trivially_destructible_v<U>;
+
+      buffer_directory<std::atomic<column*>, STORAGE::MAX_BUFFERS> d_columns;
+
+      static column* new_column() {
+        if constexpr (ZEROED_COLUMNS) {
+          void* memory = std::calloc(1, sizeof(column));
+          if (memory == nullptr) {
+            std::cerr << "Failed to allocate a side table column." << std::endl;
+            std::abort();
+          }
+          return static_cast<column*>(memory);
+        } else {
+          return new column{};
+        }
+      }
+
+      static void delete_column(column* c) {
+        if constexpr (ZEROED_COLUMNS) {
+          std::free(c);
+        } else {
+          delete c;
+        }
+      }
+
+      // The column of a buffer, or null if it was never allocated.
+      column* find_column(index_type index) const {
+        std::atomic<column*>* entry = d_columns.find(STORAGE::buffer_of(index));
+        return entry == nullptr ? nullptr : entry->load(std::memory_order_acquire);
+      }
+
+      constexpr static index_type slot_of(index_type index) {
+        return index & ((index_type(1) << STORAGE::BUFFER_BITS) - 1);
+      }
+
+      column& column_for(index_type index) {
+        std::atomic<column*>& entry = d_columns.create(STORAGE::buffer_of(index));
+        column* c = entry.load(std::memory_order_acquire);
+        if (c == nullptr) {
+          column* created = new_column();
+          if (entry.compare_exchange_strong(c, created, std::memory_order_acq_rel)) {
+            c = created;
+          } else {
+            delete_column(created);
+          }
+        }
+        return *c;
+      }
+
+      static void on_release(void* context, index_type index) {
+        static_cast<side_table*>(context)->reset(index);
+      }
+
+    public:
+      side_table() {
+        if (!STORAGE::add_release_listener(&on_release, this)) {
+          std::cerr << "Too many side tables for one storage." << std::endl;
+          std::abort();
+        }
+      }
+
+      side_table(const side_table&) = delete;
+      side_table& operator=(const side_table&) = delete;
+
+      ~side_table() {
+        STORAGE::remove_release_listener(this);
+        d_columns.for_each_entry([](std::atomic<column*>& entry) {
+          column* c = entry.load();
+          if (c != nullptr) {
+            delete_column(c);
+          }
+        });
+        d_columns.clear();
+      }
+
+      // The entry, allocating its column if needed. Use find() or
+      // get() to only read.
+      U& operator[](const ref_type& ref) {
+        return at(ref.index());
+      }
+
+      U& at(index_type index) {
+        return column_for(index)[slot_of(index)];
+      }
+
+      // The entry, or null if nothing in its buffer was ever written.
+      // Never allocates.
+      U* find(const ref_type& ref) {
+        column* c = find_column(ref.index());
+        return c == nullptr ? nullptr : &(*c)[slot_of(ref.index())];
+      }
+
+      const U* find(const ref_type& ref) const {
+        column* c = find_column(ref.index());
+        return c == nullptr ? nullptr : &(*c)[slot_of(ref.index())];
+      }
+
+      // A copy of the entry, or U{} if nothing in its buffer was ever
+      // written. Never allocates.
+      U get(const ref_type& ref) const {
+        const U* value = find(ref);
+        return value == nullptr ? U{} : *value;
+      }
+
+      // Reset the entry of a slot to U{}.
+      void reset(index_type index) {
+        column* c = find_column(index);
+        if (c != nullptr) {
+          U& value = (*c)[slot_of(index)];
+          std::destroy_at(&value);
+          std::construct_at(&value);
+        }
+      }
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef CPIOO_TREE_WALKER_HPP
+#define CPIOO_TREE_WALKER_HPP
+
+#include <cpioo/managed_entity.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+namespace cpioo {
+  namespace managed_entity {
+
+    enum class traversal_order {
+      breadth_first,
+      depth_first
+    };
+
+    inline void prefetch_for_read(const void* ptr) {
+#if defined(__GNUC__) || defined(__clang__)
+      __builtin_prefetch(ptr, 0, 3);
+#else
+      (void)ptr;
+#endif
+    }
+
+    // Iterative visitor for trees of references into STORAGE.
+    //
+    // Instead of recursing (where every child dereference is a
+    // dependent cache miss), the walker keeps a worklist of raw
+    // pointers to the pending nodes and issues a software prefetch
+    // for the node `prefetch_distance` positions ahead of the one
+    // being visited. The worklist holds plain pointers: the root
+    // reference keeps the whole immutable tree alive for the duration
+    // of the walk, so no reference (or std::optional of one) is ever
+    // copied and no refcount is touched.
+    //
+    // The worklist only holds nodes not visited yet: the frontier of
+    // a breadth-first walk, or the pending siblings along the path of
+    // a depth-first one. It is kept between walks, so reusing one
+    // walker per thread avoids allocating on every visit.
+    template <class STORAGE>
+    class tree_walker {
+    public:
+      using type = typename STORAGE::type;
+      using ref_type = typename STORAGE::ref_type;
+
+      // Ring buffer of pending nodes, used as a queue by breadth-first
+      // walks and as a stack by depth-first ones. Visited nodes leave
+      // it, so it grows with the widest frontier, not with the tree.
+      class worklist {
+        std::vector<const type*> d_slots;
+        std::size_t d_head = 0;
+        std::size_t d_size = 0;
+
+        // Double the capacity, moving the contents to the front.
+        void grow() {
+          std::vector<const type*> slots(d_slots.empty() ? 16 : d_slots.size() * 2);
+          for (std::size_t i = 0; i < d_size; ++i) {
+            slots[i] = (*this)[i];
+          }
+          d_slots.swap(slots);
+          d_head = 0;
+        }
+
+      public:
+        // i-th pending node, counting from the front.
+        const type*& operator[](std::size_t i) {
+          return d_slots[(d_head + i) & (d_slots.size() - 1)];
+        }
+
+        std::size_t size() const {
+          return d_size;
+        }
+
+        bool empty() const {
+          return d_size == 0;
+        }
+
+        std::size_t capacity() const {
+          return d_slots.size();
+        }
+
+        void clear() {
+          d_head = 0;
+          d_size = 0;
+        }
+
+        void push_back(const type* node) {
+          if (d_size == d_slots.size()) {
+            grow();
+          }
+          d_size++;
+          (*this)[d_size - 1] = node;
+        }
+
+        const type* pop_front() {
+          const type* node = (*this)[0];
+          d_head = (d_head + 1) & (d_slots.size() - 1);
+          d_size--;
+          return node;
+        }
+
+        const type* pop_back() {
+          const type* node = (*this)[d_size - 1];
+          d_size--;
+          return node;
+        }
+
+        // Reverse the nodes from position `first` to the back.
+        void reverse_from(std::size_t first) {
+          for (std::size_t i = first, j = d_size; i + 1 < j; ++i, --j) {
+            std::swap((*this)[i], (*this)[j - 1]);
+          }
+        }
+      };
+
+      // Handed to the children callback, which pushes each child of
+      // the node being visited.
+      class frontier {
+        worklist& d_pending;
+
+      public:
+        explicit frontier(worklist& pending)
+          : d_pending(pending) {}
+
+        void push(const ref_type& child) {
+          d_pending.push_back(child.get());
+        }
+
+        void push(const std::optional<ref_type>& child) {
+          if (child.has_value()) {
+            d_pending.push_back(child->get());
+          }
+        }
+      };
+
+    private:
+      worklist d_pending;
+      traversal_order d_order;
+      std::size_t d_prefetch_distance;
+
+      template <class CHILDREN, class VISIT>
+      void walk_breadth_first(CHILDREN& children, VISIT& visit) {
+        frontier f(d_pending);
+        while (!d_pending.empty()) {
+          if (d_prefetch_distance != 0 && d_prefetch_distance < d_pending.size()) {
+            prefetch_for_read(d_pending[d_prefetch_distance]);
+          }
+          const type* node = d_pending.pop_front();
+          visit(*node);
+          children(*node, f);
+        }
+      }
+
+      template <class CHILDREN, class VISIT>
+      void walk_depth_first(CHILDREN& children, VISIT& visit) {
+        frontier f(d_pending);
+        while (!d_pending.empty()) {
+          const type* node = d_pending.pop_back();
+          if (d_prefetch_distance != 0 &&
+              d_pending.size() >= d_prefetch_distance) {
+            prefetch_for_read(d_pending[d_pending.size() - d_prefetch_distance]);
+          }
+          visit(*node);
+          std::size_t before = d_pending.size();
+          children(*node, f);
+          // children were pushed in order, flip them so the first
+          // child is the next one popped.
+          d_pending.reverse_from(before);
+          if (d_prefetch_distance != 0 && d_pending.size() > before) {
+            prefetch_for_read(d_pending[d_pending.size() - 1]);
+          }
+        }
+      }
+
+    public:
+      explicit tree_walker(traversal_order order = traversal_order::breadth_first,
+                           std::size_t prefetch_distance = 8)
+        : d_order(order), d_prefetch_distance(prefetch_distance) {}
+
+      traversal_order order() const {
+        return d_order;
+      }
+
+      std::size_t prefetch_distance() const {
+        return d_prefetch_distance;
+      }
+
+      // Slots currently allocated for the worklist.
+      std::size_t worklist_capacity() const {
+        return d_pending.capacity();
+      }
+
+      // Visit every node reachable from root. `children(node,
+      // frontier)` must push the children of node into the frontier;
+      // `visit(node)` is called once per node, in the configured
+      // order.
+      template <class CHILDREN, class VISIT>
+      void walk(const ref_type& root, CHILDREN&& children, VISIT&& visit) {
+        d_pending.clear();
+        d_pending.push_back(root.get());
+        if (d_order == traversal_order::breadth_first) {
+          walk_breadth_first(children, visit);
+        } else {
+          walk_depth_first(children, visit);
+        }
+      }
+
+      template <class CHILDREN, class VISIT>
+      void walk(const std::optional<ref_type>& root, CHILDREN&& children, VISIT&& visit) {
+        if (root.has_value()) {
+          walk(*root, children, visit);
+        }
+      }
+    };
+
+  }
+}
+
+#endif
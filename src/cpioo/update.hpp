@@ -0,0 +1,50 @@
+#ifndef CPIOO_UPDATE_HPP
+#define CPIOO_UPDATE_HPP
+
+#include <cpioo/managed_entity.hpp>
+
+#include <iterator>
+#include <utility>
+
+namespace cpioo {
+  namespace managed_entity {
+
+    namespace detail {
+      template <class REF, class IT, class FN>
+      REF update_path(const REF& node, IT first, IT last, FN& fn) {
+        if (first == last) {
+          return fn(*node);
+        }
+        const auto& key = *first;
+        REF child = update_path(child_at(*node, key), std::next(first), last, fn);
+        return with_child(*node, key, std::move(child));
+      }
+    }
+
+    // Path-copying update of an immutable tree: returns a new root
+    // where the node at the end of `path` is replaced by fn(node).
+    //
+    // Only the nodes on the path are rebuilt. Everything else is
+    // shared with the old tree, so each rebuilt node costs one
+    // construction and one refcount increment per sibling it shares;
+    // the rebuilt child below it is moved in.
+    //
+    // `path` is any range of keys, and the node type T must provide,
+    // findable through ADL,
+    //
+    //   const REF& child_at(const T& node, const KEY& key);
+    //   REF with_child(const T& node, const KEY& key, REF&& child);
+    //
+    // where with_child makes a copy of node with the child at `key`
+    // replaced, typically with make_entity(ARGS&&...). fn takes the
+    // old node and returns a reference to its replacement.
+    template <class STORAGE, class PATH, class FN>
+    reference<STORAGE> update(const reference<STORAGE>& root,
+                              const PATH& path, FN&& fn) {
+      return detail::update_path(root, std::begin(path), std::end(path), fn);
+    }
+
+  }
+}
+
+#endif
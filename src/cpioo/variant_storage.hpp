@@ -0,0 +1,321 @@
+#ifndef CPIOO_VARIANT_STORAGE_HPP
+#define CPIOO_VARIANT_STORAGE_HPP
+
+#include <cpioo/managed_entity.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace cpioo {
+  namespace managed_entity {
+
+    // One slot of a variant_storage size class: the bytes of whichever
+    // alternative lives there, followed by its type tag.
+    template <class VARIANT_STORAGE, std::size_t SIZE_CLASS>
+    class variant_slab {
+      alignas(VARIANT_STORAGE::alignment()) std::byte d_bytes[
+        VARIANT_STORAGE::class_payload(SIZE_CLASS)];
+      std::uint8_t d_type;
+
+    public:
+      template <class U, class... ARGS>
+        requires std::is_constructible_v<U, ARGS...>
+      explicit variant_slab(std::in_place_type_t<U>, ARGS&&... args)
+        : d_type(VARIANT_STORAGE::template type_index<U>) {
+        std::construct_at(reinterpret_cast<U*>(d_bytes), std::forward<ARGS>(args)...);
+      }
+
+      // Slabs are only ever constructed in place in their storage.
+      variant_slab(variant_slab&&) = delete;
+      variant_slab(const variant_slab&) = delete;
+      variant_slab& operator=(const variant_slab&) = delete;
+      variant_slab& operator=(variant_slab&&) = delete;
+
+      ~variant_slab() {
+        VARIANT_STORAGE::destroy(d_type, d_bytes);
+      }
+
+      const void* data() const {
+        return d_bytes;
+      }
+
+      std::uint8_t type() const {
+        return d_type;
+      }
+    };
+
+    // Reference to an entity of a variant_storage. Behaves like
+    // `reference`, but also carries which alternative it refers to,
+    // and is read through visit, get_if or holds.
+    template <class VARIANT_STORAGE>
+    class variant_reference {
+      using index_type = typename VARIANT_STORAGE::index_type;
+
+      // Null only for a moved-from reference.
+      const void* d_data;
+      index_type d_index;
+      std::uint8_t d_type;
+
+      friend VARIANT_STORAGE;
+
+      struct adopt_count {};
+
+      // Takes over the count a new entity was made with.
+      variant_reference(adopt_count, std::uint8_t type, index_type index, const void* data)
+        : d_data(data), d_index(index), d_type(type) {}
+
+    public:
+      variant_reference(std::uint8_t type, index_type index, const void* data)
+        : d_data(data), d_index(index), d_type(type) {
+        VARIANT_STORAGE::refcnt_add(d_type, d_index);
+      }
+
+      variant_reference(const variant_reference& other)
+        : d_data(other.d_data), d_index(other.d_index), d_type(other.d_type) {
+        VARIANT_STORAGE::refcnt_add(d_type, d_index);
+      }
+
+      variant_reference(variant_reference&& other) noexcept
+        : d_data(other.d_data), d_index(other.d_index), d_type(other.d_type) {
+        other.d_data = nullptr;
+      }
+
+      variant_reference& operator=(const variant_reference& other) = delete;
+      variant_reference& operator=(variant_reference&& other) noexcept = delete;
+
+      ~variant_reference() {
+        if (d_data != nullptr) {
+          VARIANT_STORAGE::refcnt_subtract(d_type, d_index);
+        }
+      }
+
+      bool operator==(const variant_reference& other) const {
+        return d_data == other.d_data;
+      }
+
+      bool operator!=(const variant_reference& other) const {
+        return d_data != other.d_data;
+      }
+
+      // Call f with the referenced entity as its actual type. Every
+      // alternative must give the same return type, as with
+      // std::visit.
+      template <class F>
+      decltype(auto) visit(F&& f) const {
+        return VARIANT_STORAGE::visit(d_type, d_data, f);
+      }
+
+      template <class U>
+      bool holds() const {
+        return d_type == VARIANT_STORAGE::template type_index<U>;
+      }
+
+      // The entity as a U, or null if it is another alternative.
+      template <class U>
+      const U* get_if() const {
+        return holds<U>() ? std::launder(static_cast<const U*>(d_data)) : nullptr;
+      }
+
+      const void* data() const {
+        return d_data;
+      }
+
+      // Position of the alternative in the storage's type list.
+      std::uint8_t type() const {
+        return d_type;
+      }
+
+      std::uint8_t size_class() const {
+        return VARIANT_STORAGE::size_class_of_type(d_type);
+      }
+
+      // Slot of the referenced entity in its size class.
+      index_type index() const {
+        return d_index;
+      }
+    };
+
+    template <class F, class VARIANT_STORAGE>
+    decltype(auto) visit(F&& f, const variant_reference<VARIANT_STORAGE>& ref) {
+      return ref.visit(std::forward<F>(f));
+    }
+
+    // Storage for entities of several types, sharing buffers between
+    // types of similar size instead of keeping a separate storage per
+    // type.
+    //
+    // Slots are rounded up to a power-of-two size class and each class
+    // is a regular `storage` of variant_slab, so every alternative that
+    // fits a class shares its buffers, refcounts and free slots: a
+    // slot freed by one type is reused by the next entity of any type
+    // of its class. The last alignment() bytes of a slot hold the type
+    // tag, which references carry as well, so dispatch never needs to
+    // read the entity first.
+    //
+    // A scene graph with dozens of node types ends up with one storage
+    // per size class in use, rather than one per type.
+    //
+    // Like `storage`, it can be named while the alternatives are still
+    // incomplete, so they can hold references to each other; anything
+    // depending on their sizes is only worked out on first use.
+    template <std::size_t BUFFER_SIZE_BITS, typename INDEX_TYPE, class... Ts>
+    class basic_variant_storage {
+    public:
+      using index_type = INDEX_TYPE;
+      using ref_type = variant_reference<basic_variant_storage>;
+
+      static_assert(sizeof...(Ts) > 0 && sizeof...(Ts) <= 256);
+
+      template <std::size_t TYPE>
+      using type_at = std::tuple_element_t<TYPE, std::tuple<Ts...>>;
+
+      static constexpr std::size_t alignment() {
+        return std::max({alignof(Ts)...});
+      }
+
+      // Slots are min_slot_size() << size_class bytes.
+      static constexpr std::size_t min_slot_size() {
+        return 2 * alignment() < 16 ? 16 : 2 * alignment();
+      }
+
+      // Bytes of a slot left for the entity.
+      static constexpr std::size_t class_payload(std::size_t size_class) {
+        return (min_slot_size() << size_class) - alignment();
+      }
+
+      // Smallest size class that holds `size` bytes.
+      static constexpr std::size_t class_for_size(std::size_t size) {
+        std::size_t size_class = 0;
+        while (class_payload(size_class) < size) {
+          size_class++;
+        }
+        return size_class;
+      }
+
+      static constexpr std::size_t size_classes() {
+        return std::max({class_for_size(sizeof(Ts))...}) + 1;
+      }
+
+    private:
+      template <class U>
+      static constexpr std::size_t count_of = (std::size_t(std::is_same_v<U, Ts>) + ...);
+
+      template <class U, std::size_t... TYPE>
+      static constexpr std::size_t find_type(std::index_sequence<TYPE...>) {
+        return ((std::is_same_v<U, Ts> ? TYPE : 0) + ...);
+      }
+
+    public:
+      template <class U>
+        requires (count_of<U> == 1)
+      static constexpr std::uint8_t type_index =
+        std::uint8_t(find_type<U>(std::index_sequence_for<Ts...>()));
+
+      // Size class every alternative is stored in.
+      template <class U>
+        requires (count_of<U> == 1)
+      static constexpr std::size_t size_class_of = class_for_size(sizeof(U));
+
+      template <std::size_t SIZE_CLASS>
+      using slab = variant_slab<basic_variant_storage, SIZE_CLASS>;
+
+      template <std::size_t SIZE_CLASS>
+      using class_storage = storage<slab<SIZE_CLASS>, BUFFER_SIZE_BITS, INDEX_TYPE>;
+
+    private:
+      using refcnt_fn = void (*)(INDEX_TYPE);
+      using destroy_fn = void (*)(void*);
+
+      template <class U>
+      static void destroy_as(void* p) {
+        std::destroy_at(std::launder(static_cast<U*>(p)));
+      }
+
+      template <std::size_t TYPE, class R, class F>
+      static R visit_as(const void* p, F& f) {
+        return std::invoke(f, *std::launder(static_cast<const type_at<TYPE>*>(p)));
+      }
+
+      template <class R, class F, std::size_t... TYPE>
+      static R visit_in(std::uint8_t type, const void* p, F& f,
+                        std::index_sequence<TYPE...>) {
+        static constexpr std::array<R (*)(const void*, F&), sizeof...(Ts)> table = {
+          &visit_as<TYPE, R, F>...
+        };
+        return table[type](p, f);
+      }
+
+    public:
+      basic_variant_storage() = default;
+
+      template <class U, class... ARGS>
+        requires (count_of<U> == 1 && std::is_constructible_v<U, ARGS...>)
+      inline static ref_type make_entity(ARGS&&... args) {
+        auto [entity, index] = class_storage<size_class_of<U>>::make_counted_entity(
+          std::in_place_type<U>, std::forward<ARGS>(args)...);
+        return ref_type(typename ref_type::adopt_count(), type_index<U>, index, entity->data());
+      }
+
+      template <class F>
+      inline static decltype(auto) visit(std::uint8_t type, const void* p, F& f) {
+        using R = std::invoke_result_t<F&, const type_at<0>&>;
+        return visit_in<R>(type, p, f, std::index_sequence_for<Ts...>());
+      }
+
+      inline static void destroy(std::uint8_t type, void* p) {
+        static constexpr std::array<destroy_fn, sizeof...(Ts)> table = {
+          &destroy_as<Ts>...
+        };
+        table[type](p);
+      }
+
+      inline static std::uint8_t size_class_of_type(std::uint8_t type) {
+        static constexpr std::array<std::uint8_t, sizeof...(Ts)> table = {
+          std::uint8_t(size_class_of<Ts>)...
+        };
+        return table[type];
+      }
+
+      // Refcounts live in the storage of the alternative's size class.
+      inline static void refcnt_add(std::uint8_t type, INDEX_TYPE index) {
+        static constexpr std::array<refcnt_fn, sizeof...(Ts)> table = {
+          &class_storage<size_class_of<Ts>>::refcnt_add...
+        };
+        table[type](index);
+      }
+
+      inline static void refcnt_subtract(std::uint8_t type, INDEX_TYPE index) {
+        static constexpr std::array<refcnt_fn, sizeof...(Ts)> table = {
+          &class_storage<size_class_of<Ts>>::refcnt_subtract...
+        };
+        table[type](index);
+      }
+
+      inline static std::size_t return_free_pool_to_global() {
+        return return_free_pools(std::make_index_sequence<size_classes()>());
+      }
+
+    private:
+      template <std::size_t... SIZE_CLASS>
+      inline static std::size_t return_free_pools(std::index_sequence<SIZE_CLASS...>) {
+        return (class_storage<SIZE_CLASS>::return_free_pool_to_global() + ...);
+      }
+    };
+
+    template <class... Ts>
+    using variant_storage = basic_variant_storage<10, uint32_t, Ts...>;
+
+  }
+}
+
+#endif
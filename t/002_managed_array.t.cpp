@@ -1,6 +1,8 @@
 #include <cpioo/managed_entity.hpp>
+#include <cpioo/managed_array.hpp>
 #include "gtest/gtest.h"
 #include <future>
+#include <vector>
 
 struct TestStruct {
   double a;
@@ -167,3 +169,73 @@ TEST(t_002_managed_array, create_from_initializer_list) {
   EXPECT_EQ(1, storage.get_elements_reserved());
   EXPECT_EQ(2, storage.get_elements_capacity());
 }
+
+using array_t = cpioo::managed_entity::managed_array<int, 4, 2, 2, short>;
+using array_ref_t = array_t::ref_type;
+
+TEST(t_002_managed_array, variable_length_arrays) {
+  auto empty = array_t::make_array({});
+  EXPECT_EQ(0, empty.size());
+  EXPECT_EQ(0, empty.size_class());
+
+  auto small = array_t::make_array({1, 2, 3});
+  EXPECT_EQ(3, small.size());
+  EXPECT_EQ(0, small.size_class());
+
+  std::vector<int> values(20);
+  for (int i = 0; i < 20; ++i) {
+    values[i] = i * 10;
+  }
+  auto large = array_t::make_array(values);
+  EXPECT_EQ(20, large.size());
+  EXPECT_EQ(3, large.size_class());
+
+  // the span accessor sees the same elements
+  int sum = 0;
+  for (int v : *large) {
+    sum += v;
+  }
+  EXPECT_EQ(1900, sum);
+  EXPECT_EQ(30, large[3]);
+  EXPECT_EQ(2, (*small)[1]);
+
+  // copies share the array
+  array_ref_t copy = large;
+  EXPECT_EQ(copy, large);
+  EXPECT_EQ(large.data(), copy.data());
+}
+
+TEST(t_002_managed_array, freed_arrays_are_reused) {
+  array_t::return_free_pool_to_global();
+  using class1 = array_t::class_storage<1>;
+
+  std::optional<array_ref_t> first = array_t::make_array({1, 2, 3, 4, 5});
+  auto reserved = class1::get_elements_reserved();
+  auto index = first->index();
+  first.reset();
+
+  // a different length of the same class fits in the freed slot
+  auto second = array_t::make_array({6, 7, 8, 9, 10, 11, 12});
+  EXPECT_EQ(1, second.size_class());
+  EXPECT_EQ(index, second.index());
+  EXPECT_EQ(reserved, class1::get_elements_reserved());
+  EXPECT_EQ(12, second[6]);
+}
+
+TEST(t_002_managed_array, arrays_of_references) {
+  using ref_array_t = cpioo::managed_entity::managed_array<reference_t, 2, 1, 2, short>;
+  storage_t storage;
+
+  std::optional<reference_t> element = storage.make_entity({1.0, 2.0, 3, 4});
+  std::optional<ref_array_t::ref_type> children =
+    ref_array_t::make_array({*element, *element, *element});
+  EXPECT_EQ(3, (*children)[2]->c);
+  auto reserved = storage.get_elements_reserved();
+
+  // the array keeps the element alive until it is dropped itself
+  element.reset();
+  EXPECT_EQ(4, (*children)[0]->d);
+  children.reset();
+  reference_t reused = storage.make_entity();
+  EXPECT_EQ(reserved, storage.get_elements_reserved());
+}
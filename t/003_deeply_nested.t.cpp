@@ -1,5 +1,6 @@
 #include <cpioo/managed_entity.hpp>
 #include "gtest/gtest.h"
+#include <optional>
 
 struct TestStruct1 {
   double a;
@@ -84,3 +85,103 @@ TEST(t_004_deply_nested, initialize_nested) {
   ASSERT_EQ(4, r->ts2->ts1->d);
   ASSERT_EQ(4, r2->ts2->ts1->d);
 }
+
+struct TrackedLeaf {
+  int* alive;
+
+  explicit TrackedLeaf(int* alive) : alive(alive) {
+    (*alive)++;
+  }
+
+  TrackedLeaf(const TrackedLeaf& other) : alive(other.alive) {
+    (*alive)++;
+  }
+
+  ~TrackedLeaf() {
+    (*alive)--;
+  }
+};
+using TrackedLeaf_Storage =
+  cpioo::managed_entity::storage<TrackedLeaf, 4, short>;
+
+struct TrackedNode {
+  double g;
+  const TrackedLeaf_Storage::ref_type leaf;
+};
+using TrackedNode_Storage =
+  cpioo::managed_entity::storage<TrackedNode, 4, short>;
+using TrackedNode_Ref =
+  TrackedNode_Storage::ref_type;
+
+TEST(t_003_deply_nested, last_release_destroys_the_entity) {
+  int alive = 0;
+  std::optional<TrackedNode_Ref> node(
+    TrackedNode_Storage::make_entity({
+        1.0,
+        TrackedLeaf_Storage::make_entity(TrackedLeaf(&alive))
+      }));
+  ASSERT_EQ(1, alive);
+
+  // the node's destructor releases the leaf, the last reference to it
+  node.reset();
+  ASSERT_EQ(0, alive);
+}
+
+struct ChainLink;
+using ChainLink_Storage =
+  cpioo::managed_entity::storage<ChainLink>;
+using ChainLink_Ref =
+  ChainLink_Storage::ref_type;
+
+struct ChainLink {
+  std::optional<ChainLink_Ref> next;
+};
+
+TEST(t_003_deply_nested, long_chain_is_released_without_recursing) {
+  const int length = 1000000;
+  std::optional<ChainLink_Ref> head;
+  for (int i = 0; i < length; i++) {
+    head.emplace(ChainLink_Storage::make_entity(ChainLink{std::move(head)}));
+  }
+  // each link releases the next from its destructor, far deeper than
+  // the stack would allow if each release recursed into the next
+  head.reset();
+
+  // and every link was destroyed
+  ASSERT_EQ(0u, ChainLink_Storage::for_each_live([](auto, auto) {}));
+}
+
+struct ShortChainLink;
+// refcounts as wide as the indices, so the links waiting to be
+// released are chained through them
+using ShortChainLink_Storage =
+  cpioo::managed_entity::storage<ShortChainLink, 4, short>;
+using ShortChainLink_Ref =
+  ShortChainLink_Storage::ref_type;
+
+struct ShortChainLink {
+  std::optional<ShortChainLink_Ref> next;
+  std::optional<ShortChainLink_Ref> leaf;
+};
+
+static std::optional<ShortChainLink_Ref> make_short_chain(int length) {
+  std::optional<ShortChainLink_Ref> head;
+  for (int i = 0; i < length; i++) {
+    auto leaf = ShortChainLink_Storage::make_entity();
+    head.emplace(ShortChainLink_Storage::make_entity(
+      ShortChainLink{std::move(head), std::move(leaf)}));
+  }
+  return head;
+}
+
+TEST(t_003_deply_nested, long_chain_is_released_through_the_refcounts) {
+  // each link releases two entities, so several wait at a time
+  auto head = make_short_chain(15000);
+  auto reserved = ShortChainLink_Storage::get_elements_reserved();
+  head.reset();
+  ASSERT_EQ(0u, ShortChainLink_Storage::for_each_live([](auto, auto) {}));
+
+  // every slot is free again
+  auto again = make_short_chain(15000);
+  EXPECT_EQ(reserved, ShortChainLink_Storage::get_elements_reserved());
+}
@@ -0,0 +1,160 @@
+#include <cpioo/frame_channel.hpp>
+#include <cpioo/managed_entity.hpp>
+#include "gtest/gtest.h"
+#include <coroutine>
+#include <thread>
+#include <vector>
+
+struct TestFrame {
+  int tick;
+};
+
+using TestFrame_Storage =
+  cpioo::managed_entity::storage<TestFrame, 4, short>;
+using TestFrame_Ref =
+  TestFrame_Storage::ref_type;
+
+// Minimal eagerly started coroutine, enough to drive the awaiter.
+struct detached_task {
+  struct promise_type {
+    detached_task get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+detached_task collect_frames(cpioo::FrameChannel<int>& channel,
+                             std::vector<int>& seen_values) {
+  uint64_t seen = 0;
+  while (auto frame = co_await channel.next(seen)) {
+    seen = frame->sequence;
+    seen_values.push_back(frame->value);
+  }
+}
+
+// Coroutine that stays around after finishing, so the test can
+// destroy it while it is still suspended.
+struct owned_task {
+  struct promise_type {
+    owned_task get_return_object() {
+      return {std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+  std::coroutine_handle<promise_type> handle;
+};
+
+owned_task wait_once(cpioo::FrameChannel<int>& channel, int& received) {
+  if (auto frame = co_await channel.next(0)) {
+    received = frame->value;
+  }
+}
+
+TEST(t_004_frame_channel, try_get_newer) {
+  cpioo::FrameChannel<int> channel;
+  EXPECT_FALSE(channel.try_get_newer(0).has_value());
+
+  EXPECT_EQ(1, channel.publish(10));
+  auto frame = channel.try_get_newer(0);
+  ASSERT_TRUE(frame.has_value());
+  EXPECT_EQ(10, frame->value);
+  EXPECT_EQ(1, frame->sequence);
+
+  // the same frame is never handed out twice
+  EXPECT_FALSE(channel.try_get_newer(frame->sequence).has_value());
+}
+
+TEST(t_004_frame_channel, coalesces_to_latest) {
+  cpioo::FrameChannel<int> channel;
+  channel.publish(1);
+  channel.publish(2);
+  channel.publish(3);
+
+  // a reader that fell behind skips to the newest frame
+  auto frame = channel.wait_newer(0);
+  ASSERT_TRUE(frame.has_value());
+  EXPECT_EQ(3, frame->value);
+  EXPECT_EQ(3, frame->sequence);
+}
+
+TEST(t_004_frame_channel, close_wakes_blocked_reader) {
+  cpioo::FrameChannel<int> channel;
+  std::vector<int> received;
+
+  std::thread reader([&]() {
+    uint64_t seen = 0;
+    while (auto frame = channel.wait_newer(seen)) {
+      EXPECT_GT(frame->sequence, seen);
+      seen = frame->sequence;
+      received.push_back(frame->value);
+    }
+  });
+
+  for (int i = 1; i <= 100; ++i) {
+    channel.publish(i);
+  }
+  channel.close();
+  reader.join();
+
+  // frames may be coalesced, but they arrive in order and the last
+  // one is always delivered
+  ASSERT_FALSE(received.empty());
+  EXPECT_EQ(100, received.back());
+  for (size_t i = 1; i < received.size(); ++i) {
+    EXPECT_LT(received[i - 1], received[i]);
+  }
+}
+
+TEST(t_004_frame_channel, coroutine_reader) {
+  cpioo::FrameChannel<int> channel;
+  std::vector<int> received;
+
+  // nothing published yet, so the coroutine suspends right away
+  collect_frames(channel, received);
+  EXPECT_TRUE(received.empty());
+
+  channel.publish(1);
+  ASSERT_EQ(1, received.size());
+  EXPECT_EQ(1, received[0]);
+
+  channel.publish(2);
+  ASSERT_EQ(2, received.size());
+  EXPECT_EQ(2, received[1]);
+
+  channel.close();
+  EXPECT_EQ(2, received.size());
+}
+
+TEST(t_004_frame_channel, managed_entity_frames) {
+  TestFrame_Storage storage;
+  cpioo::FrameChannel<TestFrame_Ref> channel;
+
+  channel.publish(storage.make_entity({1}));
+  channel.publish(storage.make_entity({2}));
+
+  auto frame = channel.wait_newer(0);
+  ASSERT_TRUE(frame.has_value());
+  EXPECT_EQ(2, frame->value->tick);
+}
+
+TEST(t_004_frame_channel, destroyed_reader_is_not_resumed) {
+  cpioo::FrameChannel<int> channel;
+  int received = 0;
+  auto task = wait_once(channel, received);
+  EXPECT_FALSE(task.handle.done());
+
+  // destroying the suspended coroutine unregisters its awaiter
+  task.handle.destroy();
+  channel.publish(5);
+  EXPECT_EQ(0, received);
+
+  auto other = wait_once(channel, received);
+  EXPECT_TRUE(other.handle.done());
+  EXPECT_EQ(5, received);
+  other.handle.destroy();
+}
@@ -0,0 +1,111 @@
+#include <cpioo/tree_walker.hpp>
+#include "gtest/gtest.h"
+#include <vector>
+
+struct TreeNode;
+
+using TreeNode_Storage =
+  cpioo::managed_entity::storage<TreeNode, 4, short>;
+using TreeNode_Ref =
+  TreeNode_Storage::ref_type;
+
+struct TreeNode {
+  int value;
+  std::optional<TreeNode_Ref> left;
+  std::optional<TreeNode_Ref> right;
+};
+
+using walker_t = cpioo::managed_entity::tree_walker<TreeNode_Storage>;
+using cpioo::managed_entity::traversal_order;
+
+//        1
+//     +--+--+
+//     2     3
+//   +-+-+   +
+//   4   5   6
+static TreeNode_Ref make_tree() {
+  auto n4 = TreeNode_Storage::make_entity({4, std::nullopt, std::nullopt});
+  auto n5 = TreeNode_Storage::make_entity({5, std::nullopt, std::nullopt});
+  auto n6 = TreeNode_Storage::make_entity({6, std::nullopt, std::nullopt});
+  auto n2 = TreeNode_Storage::make_entity({2, n4, n5});
+  auto n3 = TreeNode_Storage::make_entity({3, std::nullopt, n6});
+  return TreeNode_Storage::make_entity({1, n2, n3});
+}
+
+static std::vector<int> walk(walker_t& walker, const TreeNode_Ref& root) {
+  std::vector<int> order;
+  walker.walk(root,
+              [](const TreeNode& node, walker_t::frontier& frontier) {
+                frontier.push(node.left);
+                frontier.push(node.right);
+              },
+              [&order](const TreeNode& node) {
+                order.push_back(node.value);
+              });
+  return order;
+}
+
+TEST(t_005_tree_walker, breadth_first) {
+  TreeNode_Ref root = make_tree();
+  walker_t walker(traversal_order::breadth_first, 2);
+  EXPECT_EQ(std::vector<int>({1, 2, 3, 4, 5, 6}), walk(walker, root));
+}
+
+TEST(t_005_tree_walker, depth_first) {
+  TreeNode_Ref root = make_tree();
+  walker_t walker(traversal_order::depth_first, 2);
+  EXPECT_EQ(std::vector<int>({1, 2, 4, 5, 3, 6}), walk(walker, root));
+}
+
+TEST(t_005_tree_walker, prefetch_distance_does_not_change_order) {
+  TreeNode_Ref root = make_tree();
+  for (std::size_t distance : {0, 1, 3, 64}) {
+    walker_t bfs(traversal_order::breadth_first, distance);
+    walker_t dfs(traversal_order::depth_first, distance);
+    EXPECT_EQ(std::vector<int>({1, 2, 3, 4, 5, 6}), walk(bfs, root));
+    EXPECT_EQ(std::vector<int>({1, 2, 4, 5, 3, 6}), walk(dfs, root));
+  }
+}
+
+TEST(t_005_tree_walker, walker_is_reusable) {
+  TreeNode_Ref root = make_tree();
+  auto leaf = TreeNode_Storage::make_entity({7, std::nullopt, std::nullopt});
+  walker_t walker;
+  EXPECT_EQ(6, walk(walker, root).size());
+  EXPECT_EQ(std::vector<int>({7}), walk(walker, leaf));
+  EXPECT_EQ(6, walk(walker, root).size());
+}
+
+// Heap numbered: the children of n are 2n and 2n + 1.
+static TreeNode_Ref make_full_tree(int depth, int value) {
+  if (depth == 1) {
+    return TreeNode_Storage::make_entity({value, std::nullopt, std::nullopt});
+  }
+  return TreeNode_Storage::make_entity({value,
+                                        make_full_tree(depth - 1, 2 * value),
+                                        make_full_tree(depth - 1, 2 * value + 1)});
+}
+
+TEST(t_005_tree_walker, breadth_first_over_a_wide_frontier) {
+  TreeNode_Ref root = make_full_tree(7, 1);
+  walker_t walker(traversal_order::breadth_first, 3);
+  std::vector<int> expected;
+  for (int i = 1; i < 128; i++) {
+    expected.push_back(i);
+  }
+  EXPECT_EQ(expected, walk(walker, root));
+}
+
+TEST(t_005_tree_walker, visited_nodes_leave_the_worklist) {
+  std::optional<TreeNode_Ref> chain;
+  for (int i = 0; i < 200; i++) {
+    chain.emplace(TreeNode_Storage::make_entity({i, std::move(chain), std::nullopt}));
+  }
+  walker_t bfs(traversal_order::breadth_first);
+  walker_t dfs(traversal_order::depth_first);
+  EXPECT_EQ(200, walk(bfs, *chain).size());
+  EXPECT_EQ(200, walk(dfs, *chain).size());
+  // a chain never has more than one node pending
+  EXPECT_GE(16u, bfs.worklist_capacity());
+  EXPECT_GE(16u, dfs.worklist_capacity());
+}
@@ -0,0 +1,66 @@
+#include <cpioo/managed_entity.hpp>
+#include "gtest/gtest.h"
+#include <vector>
+
+struct LocalityStruct {
+  int a;
+};
+
+using Locality_Storage =
+  cpioo::managed_entity::storage<LocalityStruct, 2, short>;
+using Locality_Ref =
+  Locality_Storage::ref_type;
+using hint_t = Locality_Storage::locality_hint;
+
+struct LocalityParent {
+  int b;
+  const Locality_Ref child;
+};
+
+using LocalityParent_Storage =
+  cpioo::managed_entity::storage<LocalityParent, 2, short>;
+
+TEST(t_006_locality_hint, allocate_near_reference) {
+  // three buffers of four elements each
+  std::vector<std::optional<Locality_Ref>> refs;
+  for (int i = 0; i < 12; ++i) {
+    refs.emplace_back(Locality_Storage::make_entity({i}));
+  }
+  EXPECT_EQ(12, Locality_Storage::get_elements_reserved());
+
+  // free one slot in the first buffer and one in the last
+  short in_first = refs[1]->index();
+  short in_last = refs[9]->index();
+  EXPECT_EQ(0, Locality_Storage::buffer_of(in_first));
+  EXPECT_EQ(2, Locality_Storage::buffer_of(in_last));
+  refs[1].reset();
+  refs[9].reset();
+
+  // a hint near an entity in the last buffer gets the slot there,
+  // even though a lower slot is free as well
+  auto near_last = Locality_Storage::make_entity(hint_t::near(*refs[11]), {100});
+  EXPECT_EQ(in_last, near_last.index());
+  EXPECT_EQ(100, near_last->a);
+
+  auto in_buffer = Locality_Storage::make_entity(hint_t::in_buffer(0), {101});
+  EXPECT_EQ(in_first, in_buffer.index());
+
+  // nothing left to reuse, so the hint falls back to a new slot
+  auto fresh = Locality_Storage::make_entity(hint_t::in_buffer(0), {102});
+  EXPECT_EQ(13, Locality_Storage::get_elements_reserved());
+  EXPECT_EQ(102, fresh->a);
+}
+
+TEST(t_006_locality_hint, releasing_destroys_the_object) {
+  {
+    auto parent = LocalityParent_Storage::make_entity(
+      {1, Locality_Storage::make_entity({2})});
+    EXPECT_EQ(2, parent->child->a);
+  }
+  // the parent released its child, so its slot is reused
+  auto reserved = Locality_Storage::get_elements_reserved();
+  auto again = LocalityParent_Storage::make_entity(
+    {3, Locality_Storage::make_entity({4})});
+  EXPECT_EQ(reserved, Locality_Storage::get_elements_reserved());
+  EXPECT_EQ(4, again->child->a);
+}
@@ -0,0 +1,148 @@
+#include <cpioo/mark_sweep_storage.hpp>
+#include "gtest/gtest.h"
+
+struct Leaf {
+  int value;
+};
+
+using Leaf_Storage =
+  cpioo::managed_entity::storage<Leaf, 4, short>;
+using Leaf_Ref =
+  Leaf_Storage::ref_type;
+
+struct TracedNode;
+
+using TracedNode_Storage =
+  cpioo::managed_entity::mark_sweep_storage<TracedNode, 4, short>;
+using TracedNode_Ref =
+  TracedNode_Storage::ref_type;
+
+static int s_traced_destroyed = 0;
+
+struct TracedNode {
+  int value;
+  std::optional<TracedNode_Ref> left;
+  std::optional<TracedNode_Ref> right;
+  std::optional<Leaf_Ref> leaf;
+
+  ~TracedNode() {
+    s_traced_destroyed++;
+  }
+};
+
+template <class F>
+void trace_references(const TracedNode& node, F&& mark) {
+  mark(node.left);
+  mark(node.right);
+  mark(node.leaf);
+}
+
+TEST(t_007_mark_sweep, collect_reclaims_unreachable) {
+  // start from a storage without garbage from earlier tests
+  TracedNode_Storage::collect();
+
+  auto a = TracedNode_Storage::make_entity({1, std::nullopt, std::nullopt, std::nullopt});
+  auto b = TracedNode_Storage::make_entity({2, std::nullopt, std::nullopt, std::nullopt});
+  auto root = TracedNode_Storage::make_entity({3, a, b, std::nullopt});
+  auto garbage = TracedNode_Storage::make_entity({4, a, std::nullopt, std::nullopt});
+  EXPECT_EQ(4, TracedNode_Storage::get_elements_reserved());
+
+  int destroyed_before = s_traced_destroyed;
+  // only `garbage` is unreachable from root
+  EXPECT_EQ(1, TracedNode_Storage::collect(root));
+  EXPECT_EQ(destroyed_before + 1, s_traced_destroyed);
+
+  // collecting again finds nothing new
+  EXPECT_EQ(0, TracedNode_Storage::collect(root));
+
+  // the shared child is still intact
+  EXPECT_EQ(1, root->left.value()->value);
+  EXPECT_EQ(2, root->right.value()->value);
+}
+
+TEST(t_007_mark_sweep, swept_slots_are_reused) {
+  // start from a storage without garbage from earlier tests
+  TracedNode_Storage::collect();
+
+  std::optional<TracedNode_Ref> root =
+    TracedNode_Storage::make_entity({0, std::nullopt, std::nullopt, std::nullopt});
+  for (int i = 1; i < 10; ++i) {
+    // each generation only keeps the previous one as a child
+    auto next = TracedNode_Storage::make_entity({i, root, std::nullopt, std::nullopt});
+    root.reset();
+    root.emplace(next);
+  }
+  auto reserved = TracedNode_Storage::get_elements_reserved();
+
+  // keep only the latest generation
+  auto latest = TracedNode_Storage::make_entity({10, std::nullopt, std::nullopt, std::nullopt});
+  root.reset();
+  EXPECT_EQ(10, TracedNode_Storage::collect(latest));
+
+  for (int i = 0; i < 10; ++i) {
+    TracedNode_Storage::make_entity({i, std::nullopt, std::nullopt, std::nullopt});
+  }
+  EXPECT_EQ(reserved + 1, TracedNode_Storage::get_elements_reserved());
+}
+
+TEST(t_007_mark_sweep, multiple_roots) {
+  // start from a storage without garbage from earlier tests
+  TracedNode_Storage::collect();
+
+  auto shared = TracedNode_Storage::make_entity({1, std::nullopt, std::nullopt, std::nullopt});
+  auto frame1 = TracedNode_Storage::make_entity({2, shared, std::nullopt, std::nullopt});
+  auto frame2 = TracedNode_Storage::make_entity({3, shared, std::nullopt, std::nullopt});
+  std::optional<TracedNode_Ref> no_frame;
+
+  EXPECT_EQ(0, TracedNode_Storage::collect(frame1, frame2, no_frame));
+  EXPECT_EQ(1, TracedNode_Storage::collect(frame2));
+  EXPECT_EQ(1, frame2->left.value()->value);
+}
+
+TEST(t_007_mark_sweep, sweeping_releases_refcounted_children) {
+  // start from a storage without garbage from earlier tests
+  TracedNode_Storage::collect();
+
+  auto node = TracedNode_Storage::make_entity(
+    {1, std::nullopt, std::nullopt, Leaf_Storage::make_entity({42})});
+  EXPECT_EQ(42, node->leaf.value()->value);
+  auto leaves_reserved = Leaf_Storage::get_elements_reserved();
+
+  auto root = TracedNode_Storage::make_entity({2, std::nullopt, std::nullopt, std::nullopt});
+  EXPECT_EQ(1, TracedNode_Storage::collect(root));
+
+  // the swept node dropped the last reference to its leaf
+  auto leaf = Leaf_Storage::make_entity({43});
+  EXPECT_EQ(leaves_reserved, Leaf_Storage::get_elements_reserved());
+}
+
+struct TracedLink;
+
+using TracedLink_Storage =
+  cpioo::managed_entity::mark_sweep_storage<TracedLink>;
+using TracedLink_Ref =
+  TracedLink_Storage::ref_type;
+
+struct TracedLink {
+  int value;
+  std::optional<TracedLink_Ref> next;
+};
+
+template <class F>
+void trace_references(const TracedLink& link, F&& mark) {
+  mark(link.next);
+}
+
+TEST(t_007_mark_sweep, long_chain_is_marked_without_recursing) {
+  const int length = 1000000;
+  std::optional<TracedLink_Ref> head;
+  for (int i = 0; i < length; i++) {
+    head.emplace(TracedLink_Storage::make_entity(TracedLink{i, std::move(head)}));
+  }
+  // far deeper than the stack would allow if marking recursed
+  EXPECT_EQ(0, TracedLink_Storage::collect(*head));
+  EXPECT_EQ(length - 1, head.value()->value);
+
+  head.reset();
+  EXPECT_EQ(length, TracedLink_Storage::collect());
+}
@@ -0,0 +1,272 @@
+#include <cpioo/managed_entity.hpp>
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+struct BitmapStruct {
+  int a;
+};
+
+using Bitmap_Storage =
+  cpioo::managed_entity::storage<BitmapStruct, 2, short>;
+using Bitmap_Ref =
+  Bitmap_Storage::ref_type;
+
+static std::vector<std::optional<Bitmap_Ref>> make_many(int count) {
+  std::vector<std::optional<Bitmap_Ref>> refs;
+  for (int i = 0; i < count; ++i) {
+    refs.emplace_back(Bitmap_Storage::make_entity({i}));
+  }
+  return refs;
+}
+
+TEST(t_008_free_bitmap, lowest_address_first) {
+  auto refs = make_many(8);
+  std::vector<short> freed;
+  for (int i : {7, 2, 5, 0}) {
+    freed.push_back(refs[i]->index());
+    refs[i].reset();
+  }
+  std::sort(freed.begin(), freed.end());
+
+  // slots come back in address order, not in the order they were freed
+  std::vector<short> reused;
+  for (int i = 0; i < 4; ++i) {
+    refs.emplace_back(Bitmap_Storage::make_entity({i}));
+    reused.push_back(refs.back()->index());
+  }
+  EXPECT_EQ(freed, reused);
+}
+
+TEST(t_008_free_bitmap, more_blocks_than_cached) {
+  // twenty buffers of four elements, far more than a thread caches
+  auto refs = make_many(80);
+  auto reserved = Bitmap_Storage::get_elements_reserved();
+
+  std::vector<short> freed;
+  for (size_t i = 0; i < refs.size(); i += 3) {
+    freed.push_back(refs[i]->index());
+    refs[i].reset();
+  }
+  std::sort(freed.begin(), freed.end());
+
+  std::vector<short> reused;
+  for (size_t i = 0; i < freed.size(); ++i) {
+    refs.emplace_back(Bitmap_Storage::make_entity({0}));
+    reused.push_back(refs.back()->index());
+  }
+  EXPECT_EQ(freed, reused);
+  EXPECT_EQ(reserved, Bitmap_Storage::get_elements_reserved());
+}
+
+TEST(t_008_free_bitmap, slots_move_between_threads) {
+  Bitmap_Storage::return_free_pool_to_global();
+  std::vector<std::optional<Bitmap_Ref>> refs;
+  std::thread producer([&refs]() {
+    refs = make_many(50);
+  });
+  producer.join();
+  auto reserved = Bitmap_Storage::get_elements_reserved();
+
+  // freed on this thread, handed over in bulk
+  refs.clear();
+  EXPECT_EQ(50, Bitmap_Storage::return_free_pool_to_global());
+
+  std::thread consumer([]() {
+    auto again = make_many(50);
+  });
+  consumer.join();
+  EXPECT_EQ(reserved, Bitmap_Storage::get_elements_reserved());
+}
+
+TEST(t_008_free_bitmap, thread_cache_stays_under_watermark) {
+  Bitmap_Storage::return_free_pool_to_global();
+  auto refs = make_many(60);
+  auto reserved = Bitmap_Storage::get_elements_reserved();
+
+  // released here without returning anything by hand
+  refs.clear();
+
+  std::thread consumer([]() {
+    auto again = make_many(60);
+  });
+  consumer.join();
+  // only what this thread kept cached had to be allocated again
+  EXPECT_LE(Bitmap_Storage::get_elements_reserved(),
+            reserved + Bitmap_Storage::FREE_POOL_HIGH_WATERMARK);
+}
+
+struct WideBitmapStruct {
+  int a;
+};
+
+// Default geometry: 1024-slot blocks, so a thread could cache up to
+// four blocks, twice the high watermark.
+using WideBitmap_Storage =
+  cpioo::managed_entity::storage<WideBitmapStruct>;
+using WideBitmap_Ref =
+  WideBitmap_Storage::ref_type;
+
+TEST(t_008_free_bitmap, watermark_at_default_block_size) {
+  EXPECT_EQ(10u, WideBitmap_Storage::LOCALITY_BLOCK_BITS);
+  EXPECT_EQ(2048u, WideBitmap_Storage::FREE_POOL_HIGH_WATERMARK);
+  const int count = 4 << WideBitmap_Storage::LOCALITY_BLOCK_BITS;
+
+  std::vector<std::optional<WideBitmap_Ref>> refs;
+  for (int i = 0; i < count; ++i) {
+    refs.emplace_back(WideBitmap_Storage::make_entity({i}));
+  }
+  auto reserved = WideBitmap_Storage::get_elements_reserved();
+  // all four blocks would fit in the cache without the watermark
+  refs.clear();
+
+  std::thread consumer([count]() {
+    std::vector<std::optional<WideBitmap_Ref>> again;
+    for (int i = 0; i < count; ++i) {
+      again.emplace_back(WideBitmap_Storage::make_entity({i}));
+    }
+  });
+  consumer.join();
+  EXPECT_LE(WideBitmap_Storage::get_elements_reserved(),
+            reserved + WideBitmap_Storage::FREE_POOL_HIGH_WATERMARK);
+}
+
+static void wait_for(std::atomic<int>& stage, int value) {
+  while (stage.load() != value) {
+    std::this_thread::yield();
+  }
+}
+
+TEST(t_008_free_bitmap, idle_worker_returns_its_cache) {
+  Bitmap_Storage::return_free_pool_to_global();
+  std::atomic<int> stage = 0;
+  size_t returned = 0;
+  std::thread worker([&]() {
+    // fewer than the watermark, so all of them stay cached
+    auto refs = make_many(6);
+    refs.clear();
+    returned = cpioo::managed_entity::free_pools::return_on_this_thread();
+    stage = 1;
+    wait_for(stage, 2);
+  });
+  wait_for(stage, 1);
+  EXPECT_LE(6u, returned);
+
+  auto reserved = Bitmap_Storage::get_elements_reserved();
+  auto again = make_many(6);
+  EXPECT_EQ(reserved, Bitmap_Storage::get_elements_reserved());
+  stage = 2;
+  worker.join();
+}
+
+TEST(t_008_free_bitmap, busy_worker_returns_its_cache_on_request) {
+  Bitmap_Storage::return_free_pool_to_global();
+  std::atomic<int> stage = 0;
+  std::thread worker([&]() {
+    auto refs = make_many(7);
+    refs.pop_back();
+    refs.pop_back();
+    refs.pop_back();
+    refs.pop_back();
+    refs.pop_back();
+    refs.pop_back();
+    stage = 1;
+    wait_for(stage, 2);
+    // the next release drops what was cached before it
+    refs.clear();
+    stage = 3;
+    wait_for(stage, 4);
+  });
+  wait_for(stage, 1);
+  cpioo::managed_entity::free_pools::request_return();
+  stage = 2;
+  wait_for(stage, 3);
+
+  auto reserved = Bitmap_Storage::get_elements_reserved();
+  auto again = make_many(6);
+  EXPECT_EQ(reserved, Bitmap_Storage::get_elements_reserved());
+  stage = 4;
+  worker.join();
+}
+
+// Flags a block in the summary without giving it any free slots, as
+// when another thread takes them between our look at the flag and
+// our claim.
+template <class STORAGE>
+struct cpioo::managed_entity::free_slots_test_access {
+  static void flag_without_slots(typename STORAGE::index_type block) {
+    STORAGE::s_free_summary[block / 64].fetch_or(uint64_t(1) << (block % 64));
+  }
+};
+
+struct HintRaceStruct {
+  int a;
+};
+
+using HintRace_Storage =
+  cpioo::managed_entity::storage<HintRaceStruct, 2, short>;
+using HintRace_Ref =
+  HintRace_Storage::ref_type;
+
+TEST(t_008_free_bitmap, failed_hinted_claim_keeps_the_cache) {
+  using hint_t = HintRace_Storage::locality_hint;
+  // six buffers of four elements, one block each
+  std::vector<std::optional<HintRace_Ref>> refs;
+  for (int i = 0; i < 24; ++i) {
+    refs.emplace_back(HintRace_Storage::make_entity({i}));
+  }
+
+  // one free slot cached in each of the first four blocks
+  for (int i : {0, 4, 8, 12}) {
+    refs[i].reset();
+  }
+  cpioo::managed_entity::free_slots_test_access<HintRace_Storage>
+    ::flag_without_slots(5);
+
+  // the hinted block has nothing to give, so the closest cached
+  // block is used
+  auto probe = HintRace_Storage::make_entity(hint_t::in_buffer(5), {100});
+  EXPECT_EQ(3, HintRace_Storage::buffer_of(probe.index()));
+
+  // and none of the other cached slots went missing
+  for (int i : {0, 4, 8}) {
+    refs[i].emplace(HintRace_Storage::make_entity({i}));
+  }
+  EXPECT_EQ(24, HintRace_Storage::get_elements_reserved());
+}
+
+struct CursorStruct {
+  int a;
+};
+
+using Cursor_Storage =
+  cpioo::managed_entity::storage<CursorStruct, 2, short>;
+using Cursor_Ref =
+  Cursor_Storage::ref_type;
+
+TEST(t_008_free_bitmap, slot_freed_below_the_scan_start) {
+  // 80 blocks, more than one summary word, none of them with free
+  // slots, so the scan has moved past all of them
+  std::vector<std::optional<Cursor_Ref>> refs;
+  for (int i = 0; i < 320; ++i) {
+    refs.emplace_back(Cursor_Storage::make_entity({i}));
+  }
+  auto reserved = Cursor_Storage::get_elements_reserved();
+
+  // freed in the first and in the last word, handed over on exit
+  short first = refs[1]->index();
+  short last = refs[300]->index();
+  std::thread other([&refs]() {
+    refs[300].reset();
+    refs[1].reset();
+  });
+  other.join();
+
+  refs[1].emplace(Cursor_Storage::make_entity({1}));
+  refs[300].emplace(Cursor_Storage::make_entity({300}));
+  EXPECT_EQ(first, refs[1]->index());
+  EXPECT_EQ(last, refs[300]->index());
+  EXPECT_EQ(reserved, Cursor_Storage::get_elements_reserved());
+}
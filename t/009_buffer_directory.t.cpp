@@ -0,0 +1,84 @@
+#include <cpioo/buffer_directory.hpp>
+#include <cpioo/managed_entity.hpp>
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <vector>
+
+using small_directory_t =
+  cpioo::managed_entity::buffer_directory<int, std::size_t(1) << 14>;
+using wide_directory_t =
+  cpioo::managed_entity::buffer_directory<int, std::size_t(1) << 38>;
+
+TEST(t_009_buffer_directory, pages_are_allocated_on_demand) {
+  static small_directory_t directory;
+  EXPECT_EQ(2, small_directory_t::LEVELS);
+  EXPECT_EQ(0, directory.pages());
+
+  directory.create(0) = 1;
+  directory.create(1) = 2;
+  EXPECT_EQ(1, directory.pages());
+
+  // far away entries get their own page
+  directory.create(10000) = 3;
+  EXPECT_EQ(2, directory.pages());
+
+  EXPECT_EQ(1, directory[0]);
+  EXPECT_EQ(2, directory[1]);
+  EXPECT_EQ(3, directory[10000]);
+
+  // entries of an existing page start value-initialized
+  EXPECT_EQ(0, directory.create(2));
+}
+
+TEST(t_009_buffer_directory, clear_frees_every_page) {
+  static wide_directory_t directory;
+  directory.create(0) = 1;
+  directory.create(std::size_t(1) << 37) = 2;
+  EXPECT_LT(0, directory.pages());
+
+  directory.clear();
+  EXPECT_EQ(0, directory.pages());
+  EXPECT_EQ(nullptr, directory.find(0));
+  EXPECT_EQ(nullptr, directory.find(std::size_t(1) << 37));
+
+  // and it can be used again
+  EXPECT_EQ(0, directory.create(0));
+}
+
+TEST(t_009_buffer_directory, wide_index_space) {
+  static wide_directory_t directory;
+  EXPECT_EQ(3, wide_directory_t::LEVELS);
+
+  std::size_t far = (std::size_t(1) << 37) + 5;
+  directory.create(7) = 7;
+  directory.create(far) = 42;
+  // a leaf and a middle page for each of the two entries
+  EXPECT_EQ(4, directory.pages());
+  EXPECT_EQ(7, directory[7]);
+  EXPECT_EQ(42, directory[far]);
+}
+
+struct WideStruct {
+  uint64_t value;
+};
+
+using WideStorage =
+  cpioo::managed_entity::storage<WideStruct, 4, uint64_t>;
+
+TEST(t_009_buffer_directory, storage_with_64_bit_indices) {
+  std::vector<std::optional<WideStorage::ref_type>> refs;
+  for (uint64_t i = 0; i < 100; ++i) {
+    refs.emplace_back(WideStorage::make_entity({i * 3}));
+  }
+  EXPECT_EQ(100, WideStorage::get_elements_reserved());
+  EXPECT_EQ(112, WideStorage::get_elements_capacity());
+  for (uint64_t i = 0; i < 100; ++i) {
+    EXPECT_EQ(i * 3, (*refs[i])->value);
+  }
+
+  // freed slots are reused like in any other storage
+  auto index = refs[50]->index();
+  refs[50].reset();
+  auto again = WideStorage::make_entity({7});
+  EXPECT_EQ(index, again.index());
+}
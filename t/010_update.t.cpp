@@ -0,0 +1,111 @@
+#include <cpioo/managed_entity.hpp>
+#include <cpioo/update.hpp>
+#include "gtest/gtest.h"
+#include <array>
+#include <vector>
+
+static int s_constructed = 0;
+static int s_copied = 0;
+
+struct Counted {
+  int value;
+
+  Counted(int value) : value(value) {
+    s_constructed++;
+  }
+
+  Counted(const Counted& other) : value(other.value) {
+    s_copied++;
+  }
+};
+
+using Counted_Storage =
+  cpioo::managed_entity::storage<Counted, 4, short>;
+
+TEST(t_010_update, emplace_constructs_in_place) {
+  s_constructed = 0;
+  s_copied = 0;
+  auto ref = Counted_Storage::make_entity(42);
+  EXPECT_EQ(42, ref->value);
+  EXPECT_EQ(1, s_constructed);
+  EXPECT_EQ(0, s_copied);
+
+  auto hinted = Counted_Storage::make_entity(
+    Counted_Storage::locality_hint::near(ref), 43);
+  EXPECT_EQ(43, hinted->value);
+  EXPECT_EQ(2, s_constructed);
+  EXPECT_EQ(0, s_copied);
+}
+
+struct Node;
+
+using Node_Storage =
+  cpioo::managed_entity::storage<Node, 4, short>;
+using Node_Ref =
+  Node_Storage::ref_type;
+
+static int s_nodes_built = 0;
+
+struct Node {
+  int value;
+  std::array<std::optional<Node_Ref>, 2> children;
+
+  Node(int value, std::optional<Node_Ref> left, std::optional<Node_Ref> right)
+    : value(value), children{std::move(left), std::move(right)} {
+    s_nodes_built++;
+  }
+};
+
+const Node_Ref& child_at(const Node& node, int side) {
+  return node.children[side].value();
+}
+
+Node_Ref with_child(const Node& node, int side, Node_Ref&& child) {
+  if (side == 0) {
+    return Node_Storage::make_entity(node.value, std::move(child), node.children[1]);
+  }
+  return Node_Storage::make_entity(node.value, node.children[0], std::move(child));
+}
+
+static Node_Ref leaf(int value) {
+  return Node_Storage::make_entity(value, std::nullopt, std::nullopt);
+}
+
+TEST(t_010_update, only_the_path_is_rebuilt) {
+  //        1
+  //     2     3
+  //    4 5   6 7
+  auto root = Node_Storage::make_entity(
+    1,
+    Node_Storage::make_entity(2, leaf(4), leaf(5)),
+    Node_Storage::make_entity(3, leaf(6), leaf(7)));
+
+  s_nodes_built = 0;
+  std::vector<int> path = {1, 0};
+  auto updated = cpioo::managed_entity::update(root, path, [](const Node& old) {
+    return Node_Storage::make_entity(old.value * 10, std::nullopt, std::nullopt);
+  });
+
+  // the leaf, its parent and the root
+  EXPECT_EQ(3, s_nodes_built);
+  EXPECT_EQ(60, updated->children[1].value()->children[0].value()->value);
+
+  // the old tree is untouched
+  EXPECT_EQ(6, root->children[1].value()->children[0].value()->value);
+
+  // everything off the path is shared
+  EXPECT_EQ(root->children[0].value(), updated->children[0].value());
+  EXPECT_EQ(root->children[1].value()->children[1].value(),
+            updated->children[1].value()->children[1].value());
+  EXPECT_NE(root->children[1].value(), updated->children[1].value());
+}
+
+TEST(t_010_update, empty_path_replaces_the_root) {
+  auto root = leaf(1);
+  std::array<int, 0> path;
+  auto updated = cpioo::managed_entity::update(root, path, [](const Node& old) {
+    return leaf(old.value + 1);
+  });
+  EXPECT_EQ(2, updated->value);
+  EXPECT_EQ(1, root->value);
+}
@@ -0,0 +1,120 @@
+#include <cpioo/managed_entity.hpp>
+#include <cpioo/side_table.hpp>
+#include "gtest/gtest.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+struct SideNode;
+
+using SideNode_Storage =
+  cpioo::managed_entity::storage<SideNode, 2, short>;
+using SideNode_Ref =
+  SideNode_Storage::ref_type;
+
+struct SideNode {
+  int value;
+  std::optional<SideNode_Ref> left;
+  std::optional<SideNode_Ref> right;
+};
+
+static int s_computed = 0;
+
+// Memoized sum of a subtree, 0 meaning "not computed yet"
+static int subtree_sum(cpioo::managed_entity::side_table<SideNode_Storage, int>& sums,
+                       const SideNode_Ref& node) {
+  int sum = sums.get(node);
+  if (sum == 0) {
+    s_computed++;
+    sum = node->value
+      + (node->left ? subtree_sum(sums, *node->left) : 0)
+      + (node->right ? subtree_sum(sums, *node->right) : 0);
+    sums[node] = sum;
+  }
+  return sum;
+}
+
+TEST(t_011_side_table, memoize_derived_values) {
+  cpioo::managed_entity::side_table<SideNode_Storage, int> sums;
+
+  auto a = SideNode_Storage::make_entity(1, std::nullopt, std::nullopt);
+  auto b = SideNode_Storage::make_entity(2, std::nullopt, std::nullopt);
+  auto root = SideNode_Storage::make_entity(3, a, b);
+
+  s_computed = 0;
+  EXPECT_EQ(6, subtree_sum(sums, root));
+  EXPECT_EQ(3, s_computed);
+
+  // a new root sharing both children only computes itself
+  auto root2 = SideNode_Storage::make_entity(10, a, b);
+  EXPECT_EQ(13, subtree_sum(sums, root2));
+  EXPECT_EQ(4, s_computed);
+  EXPECT_EQ(6, subtree_sum(sums, root));
+  EXPECT_EQ(4, s_computed);
+}
+
+TEST(t_011_side_table, released_entries_are_reset) {
+  cpioo::managed_entity::side_table<SideNode_Storage, int> flags;
+
+  std::optional<SideNode_Ref> node =
+    SideNode_Storage::make_entity(1, std::nullopt, std::nullopt);
+  auto index = node->index();
+  flags[*node] = 42;
+  EXPECT_EQ(42, *flags.find(*node));
+
+  // the slot is reused by the next entity, which starts clean
+  node.reset();
+  auto reused = SideNode_Storage::make_entity(2, std::nullopt, std::nullopt);
+  EXPECT_EQ(index, reused.index());
+  EXPECT_EQ(0, flags[reused]);
+}
+
+TEST(t_011_side_table, columns_are_allocated_on_write) {
+  cpioo::managed_entity::side_table<SideNode_Storage, int> lazy;
+  auto node = SideNode_Storage::make_entity(1, std::nullopt, std::nullopt);
+  EXPECT_EQ(nullptr, lazy.find(node));
+  // reading doesn't allocate either
+  EXPECT_EQ(0, lazy.get(node));
+  const auto& const_lazy = lazy;
+  EXPECT_EQ(nullptr, const_lazy.find(node));
+  lazy[node] = 1;
+  EXPECT_NE(nullptr, lazy.find(node));
+}
+
+TEST(t_011_side_table, atomic_columns_across_threads) {
+  cpioo::managed_entity::side_table<SideNode_Storage, std::atomic<int>> visits;
+  auto node = SideNode_Storage::make_entity(1, std::nullopt, std::nullopt);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < 1000; ++i) {
+        visits[node]++;
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(4000, visits[node].load());
+}
+
+TEST(t_011_side_table, zeroed_columns_read_as_default) {
+  struct Bounds {
+    float min;
+    float max;
+    int generation;
+  };
+  cpioo::managed_entity::side_table<SideNode_Storage, Bounds> bounds;
+  auto a = SideNode_Storage::make_entity(1, std::nullopt, std::nullopt);
+  auto b = SideNode_Storage::make_entity(2, std::nullopt, std::nullopt);
+  bounds[a] = Bounds{1.0f, 2.0f, 3};
+
+  // b was never written, so it reads as zero whether or not it is
+  // in the column allocated for a
+  Bounds other = bounds[b];
+  EXPECT_EQ(0.0f, other.min);
+  EXPECT_EQ(0.0f, other.max);
+  EXPECT_EQ(0, other.generation);
+  EXPECT_EQ(3, bounds.get(a).generation);
+}
@@ -0,0 +1,215 @@
+#include <cpioo/managed_entity.hpp>
+#include <cpioo/delta_stream.hpp>
+#include <cpioo/update.hpp>
+#include "gtest/gtest.h"
+#include <array>
+#include <cstdint>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+struct DeltaNode;
+
+using DeltaNode_Storage =
+  cpioo::managed_entity::storage<DeltaNode, 4, uint32_t>;
+using DeltaNode_Ref =
+  DeltaNode_Storage::ref_type;
+using encoder_t = cpioo::managed_entity::delta_encoder<DeltaNode_Storage>;
+using decoder_t = cpioo::managed_entity::delta_decoder<DeltaNode_Storage>;
+
+struct DeltaNode {
+  int value;
+  std::array<std::optional<DeltaNode_Ref>, 2> children;
+
+  DeltaNode(int value, std::optional<DeltaNode_Ref> left, std::optional<DeltaNode_Ref> right)
+    : value(value), children{std::move(left), std::move(right)} {}
+};
+
+template <class F>
+void for_each_child(const DeltaNode& node, F&& f) {
+  f(node.children[0]);
+  f(node.children[1]);
+}
+
+void encode_entity(const DeltaNode& node, encoder_t& out) {
+  out.write_signed(node.value);
+  out.write_child(node.children[0]);
+  out.write_child(node.children[1]);
+}
+
+DeltaNode_Ref decode_entity(decoder_t& in) {
+  int value = int(in.read_signed());
+  auto left = in.read_child();
+  auto right = in.read_child();
+  return DeltaNode_Storage::make_entity(value, std::move(left), std::move(right));
+}
+
+const DeltaNode_Ref& child_at(const DeltaNode& node, int side) {
+  return node.children[side].value();
+}
+
+DeltaNode_Ref with_child(const DeltaNode& node, int side, DeltaNode_Ref&& child) {
+  if (side == 0) {
+    return DeltaNode_Storage::make_entity(node.value, std::move(child), node.children[1]);
+  }
+  return DeltaNode_Storage::make_entity(node.value, node.children[0], std::move(child));
+}
+
+static DeltaNode_Ref make_tree(int depth, int& counter) {
+  int value = counter++;
+  if (depth == 1) {
+    return DeltaNode_Storage::make_entity(value, std::nullopt, std::nullopt);
+  }
+  auto left = make_tree(depth - 1, counter);
+  auto right = make_tree(depth - 1, counter);
+  return DeltaNode_Storage::make_entity(value, std::move(left), std::move(right));
+}
+
+static bool same_tree(const std::optional<DeltaNode_Ref>& a,
+                      const std::optional<DeltaNode_Ref>& b) {
+  if (a.has_value() != b.has_value()) {
+    return false;
+  }
+  if (!a.has_value()) {
+    return true;
+  }
+  return (*a)->value == (*b)->value
+    && same_tree((*a)->children[0], (*b)->children[0])
+    && same_tree((*a)->children[1], (*b)->children[1]);
+}
+
+// The frames both sides of the pipe agree on: a full tree, then one
+// changed leaf, then a new subtree that holds one new node twice.
+static std::vector<DeltaNode_Ref> make_frames() {
+  int counter = 0;
+  std::vector<DeltaNode_Ref> frames;
+  frames.push_back(make_tree(6, counter));
+
+  std::vector<int> path = {1, 0, 1, 1, 0};
+  frames.push_back(cpioo::managed_entity::update(frames.back(), path, [](const DeltaNode& old) {
+    return DeltaNode_Storage::make_entity(-old.value, std::nullopt, std::nullopt);
+  }));
+
+  auto shared = DeltaNode_Storage::make_entity(1000, std::nullopt, std::nullopt);
+  frames.push_back(DeltaNode_Storage::make_entity(
+    1001,
+    frames.back()->children[0],
+    DeltaNode_Storage::make_entity(
+      1002, shared, DeltaNode_Storage::make_entity(1003, shared, std::nullopt))));
+  return frames;
+}
+
+TEST(t_012_delta_stream, deltas_carry_only_new_entities) {
+  auto frames = make_frames();
+  encoder_t encoder;
+  decoder_t decoder;
+
+  auto full = encoder.encode(std::nullopt, frames[0]);
+  EXPECT_EQ(63, encoder.entities());
+  std::optional<DeltaNode_Ref> replica = decoder.decode(full, std::nullopt);
+  EXPECT_TRUE(same_tree(frames[0], replica));
+
+  // one leaf changed: only the path to it is sent
+  auto delta = encoder.encode(frames[0], frames[1]);
+  EXPECT_EQ(6, encoder.entities());
+  EXPECT_LT(delta.size(), full.size() / 4);
+  auto next = decoder.decode(delta, replica);
+  EXPECT_TRUE(same_tree(frames[1], next));
+
+  // the replica shares what didn't change with its previous frame
+  EXPECT_EQ((*replica)->children[0].value(), (*next)->children[0].value());
+  EXPECT_NE((*replica)->children[1].value(), (*next)->children[1].value());
+
+  // a new entity referenced twice is sent once, and stays shared
+  encoder.encode(frames[1], frames[2]);
+  EXPECT_EQ(4, encoder.entities());
+  auto last = decoder.decode(encoder.encode(frames[1], frames[2]), next);
+  EXPECT_TRUE(same_tree(frames[2], last));
+  auto& right = (*last)->children[1].value();
+  EXPECT_EQ(right->children[0].value(), right->children[1].value()->children[0].value());
+  EXPECT_EQ((*next)->children[0].value(), (*last)->children[0].value());
+}
+
+TEST(t_012_delta_stream, replicate_over_a_pipe) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    // sender: write every delta with a length prefix
+    close(fds[0]);
+    auto frames = make_frames();
+    encoder_t encoder;
+    std::optional<DeltaNode_Ref> sent;
+    for (auto& frame : frames) {
+      auto bytes = encoder.encode(sent, frame);
+      uint32_t size = bytes.size();
+      if (write(fds[1], &size, sizeof(size)) != sizeof(size) ||
+          write(fds[1], bytes.data(), size) != ssize_t(size)) {
+        _exit(1);
+      }
+      sent.reset();
+      sent.emplace(frame);
+    }
+    close(fds[1]);
+    _exit(0);
+  }
+
+  close(fds[1]);
+  auto expected = make_frames();
+  decoder_t decoder;
+  std::optional<DeltaNode_Ref> replica;
+  for (auto& frame : expected) {
+    uint32_t size;
+    ASSERT_EQ(ssize_t(sizeof(size)), read(fds[0], &size, sizeof(size)));
+    std::vector<uint8_t> bytes(size);
+    size_t got = 0;
+    while (got < size) {
+      ssize_t n = read(fds[0], bytes.data() + got, size - got);
+      ASSERT_GT(n, 0);
+      got += n;
+    }
+    auto next = decoder.decode(bytes, replica);
+    EXPECT_TRUE(same_tree(frame, next));
+    replica.reset();
+    replica.emplace(*next);
+  }
+  close(fds[0]);
+
+  int status;
+  waitpid(pid, &status, 0);
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+}
+
+TEST(t_012_delta_stream, deep_chain_round_trip) {
+  // far deeper than the stack would allow if either side recursed
+  const int length = 300000;
+  std::optional<DeltaNode_Ref> chain;
+  for (int i = 0; i < length; i++) {
+    chain.emplace(DeltaNode_Storage::make_entity(i, std::move(chain), std::nullopt));
+  }
+  encoder_t encoder;
+  decoder_t decoder;
+  auto replica = decoder.decode(encoder.encode(std::nullopt, chain), std::nullopt);
+  EXPECT_EQ(size_t(length), encoder.entities());
+
+  const DeltaNode* a = chain->get();
+  const DeltaNode* b = replica->get();
+  int links = 0;
+  while (a != nullptr && b != nullptr && a->value == b->value) {
+    a = a->children[0].has_value() ? a->children[0]->get() : nullptr;
+    b = b->children[0].has_value() ? b->children[0]->get() : nullptr;
+    links++;
+  }
+  EXPECT_EQ(length, links);
+  EXPECT_EQ(nullptr, b);
+
+  // a changed head only sends the head
+  auto changed = DeltaNode_Storage::make_entity(-1, (*chain)->children[0], std::nullopt);
+  auto next = decoder.decode(encoder.encode(chain, changed), replica);
+  EXPECT_EQ(1u, encoder.entities());
+  EXPECT_EQ(-1, (*next)->value);
+  EXPECT_EQ((*replica)->children[0].value(), (*next)->children[0].value());
+}
@@ -0,0 +1,82 @@
+#include <cpioo/managed_entity.hpp>
+#include "gtest/gtest.h"
+#include <atomic>
+#include <vector>
+
+struct ScanStruct {
+  int value;
+};
+
+using Scan_Storage =
+  cpioo::managed_entity::storage<ScanStruct, 6, uint32_t>;
+using Scan_Ref =
+  Scan_Storage::ref_type;
+
+// Same, with 32-bit refcounts
+using WideScan_Storage =
+  cpioo::managed_entity::storage<
+    ScanStruct, 6, uint32_t,
+    cpioo::managed_entity::superbuffer_count<uint32_t>(6),
+    cpioo::managed_entity::buffer_count(6),
+    int>;
+
+template <class STORAGE>
+static void check_scan() {
+  std::vector<std::optional<typename STORAGE::ref_type>> refs;
+  for (int i = 0; i < 300; ++i) {
+    refs.emplace_back(STORAGE::make_entity(ScanStruct{i}));
+  }
+  long expected = 0;
+  size_t live = 0;
+  for (int i = 0; i < 300; ++i) {
+    if (i % 3 == 0 || (i >= 100 && i < 140)) {
+      refs[i].reset();
+    } else {
+      expected += i;
+      live++;
+    }
+  }
+
+  long sum = 0;
+  size_t batches = 0;
+  size_t visited = STORAGE::for_each_live(
+    [&](std::span<const ScanStruct> batch, uint32_t first_index) {
+      batches++;
+      for (size_t k = 0; k < batch.size(); ++k) {
+        EXPECT_EQ(first_index + k, uint32_t(batch[k].value));
+        sum += batch[k].value;
+      }
+    });
+  EXPECT_EQ(live, visited);
+  EXPECT_EQ(expected, sum);
+  // runs of two between every freed third, split at buffer edges
+  EXPECT_LT(batches, live);
+
+  std::atomic<long> parallel_sum = 0;
+  size_t parallel_visited = STORAGE::parallel_for_each_live(
+    [&](std::span<const ScanStruct> batch, uint32_t) {
+      long local = 0;
+      for (auto& s : batch) {
+        local += s.value;
+      }
+      parallel_sum += local;
+    }, 4);
+  EXPECT_EQ(live, parallel_visited);
+  EXPECT_EQ(expected, parallel_sum.load());
+}
+
+TEST(t_013_live_scan, short_refcounts) {
+  check_scan<Scan_Storage>();
+}
+
+TEST(t_013_live_scan, int_refcounts) {
+  check_scan<WideScan_Storage>();
+}
+
+TEST(t_013_live_scan, live_mask) {
+  std::array<std::atomic<short>, 16> counts{};
+  counts[0] = 1;
+  counts[5] = 2;
+  counts[15] = -1;
+  EXPECT_EQ(0x8021u, cpioo::managed_entity::live_mask(counts.data()));
+}
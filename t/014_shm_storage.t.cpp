@@ -0,0 +1,240 @@
+#include <cpioo/managed_entity.hpp>
+#include <cpioo/shm_storage.hpp>
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct ShmNode;
+
+// Each test creates its own segment and attaches the storage to it;
+// destroying the segment detaches the storage again.
+using ShmNode_Storage =
+  cpioo::managed_entity::shm_storage<ShmNode, 4, uint32_t>;
+using ShmNode_Ref =
+  ShmNode_Storage::ref_type;
+using segment_t = cpioo::managed_entity::shm_segment;
+using publisher_t = cpioo::managed_entity::shm_publisher<ShmNode_Storage>;
+using reader_t = cpioo::managed_entity::shm_frame_reader<ShmNode>;
+
+struct ShmNode {
+  int value;
+  std::optional<ShmNode_Ref> left;
+  std::optional<ShmNode_Ref> right;
+
+  ShmNode(int value, std::optional<ShmNode_Ref> left,
+          std::optional<ShmNode_Ref> right)
+    : value(value), left(std::move(left)), right(std::move(right)) {}
+};
+
+static ShmNode_Ref make_tree(int depth, int value) {
+  if (depth == 1) {
+    return ShmNode_Storage::make_entity(value, std::nullopt, std::nullopt);
+  }
+  return ShmNode_Storage::make_entity(value,
+                                      make_tree(depth - 1, value),
+                                      make_tree(depth - 1, value));
+}
+
+// Readers only follow pointers, never copy references.
+static long sum(const ShmNode* node) {
+  long total = node->value;
+  if (node->left.has_value()) {
+    total += sum(node->left->get());
+  }
+  if (node->right.has_value()) {
+    total += sum(node->right->get());
+  }
+  return total;
+}
+
+static std::string segment_name() {
+  return "/cpioo_t014_" + std::to_string(getpid());
+}
+
+static bool wait_byte(int fd) {
+  char c;
+  return read(fd, &c, 1) == 1;
+}
+
+static bool send_long(int fd, long value) {
+  return write(fd, &value, sizeof(value)) == ssize_t(sizeof(value));
+}
+
+TEST(t_014_shm_storage, reader_process_sees_published_frames) {
+  std::string name = segment_name();
+  int to_reader[2];
+  int to_writer[2];
+  ASSERT_EQ(0, pipe(to_reader));
+  ASSERT_EQ(0, pipe(to_writer));
+
+  // Forked before the segment exists, so the reader maps it itself.
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    close(to_reader[1]);
+    close(to_writer[0]);
+    if (!wait_byte(to_reader[0])) {
+      _exit(1);
+    }
+    auto segment = segment_t::open(name);
+    if (!segment) {
+      _exit(2);
+    }
+    {
+      reader_t reader(*segment);
+      uint64_t sequence;
+      const ShmNode* root = reader.pin_latest(&sequence);
+      if (root == nullptr || !send_long(to_writer[1], sequence)
+          || !send_long(to_writer[1], sum(root))) {
+        _exit(3);
+      }
+      // Keep frame 1 pinned while the writer publishes frame 2.
+      if (!wait_byte(to_reader[0]) || !send_long(to_writer[1], sum(root))) {
+        _exit(4);
+      }
+      root = reader.pin_latest(&sequence);
+      if (root == nullptr || !send_long(to_writer[1], sequence)
+          || !send_long(to_writer[1], sum(root))) {
+        _exit(5);
+      }
+      if (!wait_byte(to_reader[0])) {
+        _exit(6);
+      }
+    }
+    _exit(0);
+  }
+
+  close(to_reader[0]);
+  close(to_writer[1]);
+  auto segment = segment_t::create(name, 1 << 20);
+  ASSERT_TRUE(segment);
+  ShmNode_Storage::attach(*segment);
+  publisher_t publisher(*segment);
+
+  // a full tree of depth 6 has 63 nodes
+  EXPECT_EQ(1u, publisher.publish(make_tree(6, 1)));
+  ASSERT_EQ(1, write(to_reader[1], "g", 1));
+  long value;
+  ASSERT_EQ(ssize_t(sizeof(value)), read(to_writer[0], &value, sizeof(value)));
+  EXPECT_EQ(1, value);
+  ASSERT_EQ(ssize_t(sizeof(value)), read(to_writer[0], &value, sizeof(value)));
+  EXPECT_EQ(63, value);
+
+  EXPECT_EQ(2u, publisher.publish(make_tree(6, 2)));
+  // frame 1 is pinned, so it is still held, and intact
+  EXPECT_EQ(2u, publisher.held());
+  ASSERT_EQ(1, write(to_reader[1], "g", 1));
+  ASSERT_EQ(ssize_t(sizeof(value)), read(to_writer[0], &value, sizeof(value)));
+  EXPECT_EQ(63, value);
+
+  ASSERT_EQ(ssize_t(sizeof(value)), read(to_writer[0], &value, sizeof(value)));
+  EXPECT_EQ(2, value);
+  ASSERT_EQ(ssize_t(sizeof(value)), read(to_writer[0], &value, sizeof(value)));
+  EXPECT_EQ(126, value);
+  // the reader moved on to frame 2, so frame 1 can go
+  publisher.release_unpinned();
+  EXPECT_EQ(1u, publisher.held());
+
+  ASSERT_EQ(1, write(to_reader[1], "g", 1));
+  close(to_reader[1]);
+  close(to_writer[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+}
+
+TEST(t_014_shm_storage, pins_of_dead_readers_are_dropped) {
+  std::string name = segment_name();
+  int to_reader[2];
+  int to_writer[2];
+  ASSERT_EQ(0, pipe(to_reader));
+  ASSERT_EQ(0, pipe(to_writer));
+
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    close(to_reader[1]);
+    close(to_writer[0]);
+    if (!wait_byte(to_reader[0])) {
+      _exit(1);
+    }
+    auto segment = segment_t::open(name);
+    if (!segment) {
+      _exit(2);
+    }
+    // Pin and die without unpinning.
+    auto* reader = new reader_t(*segment);
+    if (reader->pin_latest() == nullptr || !send_long(to_writer[1], 0)) {
+      _exit(3);
+    }
+    _exit(0);
+  }
+
+  close(to_reader[0]);
+  close(to_writer[1]);
+  auto segment = segment_t::create(name, 1 << 20);
+  ASSERT_TRUE(segment);
+  ShmNode_Storage::attach(*segment);
+  publisher_t publisher(*segment);
+
+  publisher.publish(make_tree(3, 1));
+  ASSERT_EQ(1, write(to_reader[1], "g", 1));
+  long value;
+  ASSERT_EQ(ssize_t(sizeof(value)), read(to_writer[0], &value, sizeof(value)));
+  int status;
+  waitpid(pid, &status, 0);
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+
+  publisher.publish(make_tree(3, 2));
+  EXPECT_EQ(1u, publisher.held());
+  for (auto& reader : segment->get_header().readers) {
+    EXPECT_EQ(0, reader.pid.load());
+  }
+  close(to_reader[1]);
+  close(to_writer[0]);
+}
+
+TEST(t_014_shm_storage, buffers_live_in_the_segment) {
+  auto segment = segment_t::create(segment_name(), 1 << 20);
+  ASSERT_TRUE(segment);
+  ShmNode_Storage::attach(*segment);
+  std::size_t used = segment->get_header().arena_used;
+  auto tree = make_tree(8, 1);
+  // 255 nodes need new buffers, carved out of the arena
+  EXPECT_GT(segment->get_header().arena_used.load(), used);
+  auto* base = reinterpret_cast<const std::byte*>(&segment->get_header());
+  auto* node = reinterpret_cast<const std::byte*>(tree.get());
+  EXPECT_GE(node, base + segment->get_header().header_size);
+  EXPECT_LT(node, base + segment->get_header().header_size
+                     + segment->get_header().arena_size);
+}
+
+TEST(t_014_shm_storage, destroying_the_segment_detaches_the_storage) {
+  {
+    auto segment = segment_t::create(segment_name(), 1 << 20);
+    ASSERT_TRUE(segment);
+    ShmNode_Storage::attach(*segment);
+    EXPECT_EQ(31, sum(make_tree(5, 1).get()));
+    EXPECT_LT(0u, ShmNode_Storage::get_elements_capacity());
+  }
+  // the buffers went with the segment
+  EXPECT_EQ(nullptr, ShmNode_Storage::segment());
+  EXPECT_EQ(0u, ShmNode_Storage::get_elements_capacity());
+
+  // a new segment at the same address starts from scratch
+  auto segment = segment_t::create(segment_name(), 1 << 20);
+  ASSERT_TRUE(segment);
+  ShmNode_Storage::attach(*segment);
+  auto tree = make_tree(5, 2);
+  EXPECT_EQ(62, sum(tree.get()));
+  auto* base = reinterpret_cast<const std::byte*>(&segment->get_header());
+  auto* node = reinterpret_cast<const std::byte*>(tree.get());
+  EXPECT_GE(node, base + segment->get_header().header_size);
+  EXPECT_LT(node, base + segment->get_header().header_size
+                     + segment->get_header().arena_size);
+}
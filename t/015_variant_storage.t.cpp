@@ -0,0 +1,111 @@
+#include <cpioo/managed_entity.hpp>
+#include <cpioo/variant_storage.hpp>
+#include "gtest/gtest.h"
+#include <array>
+#include <cstdint>
+#include <optional>
+
+struct Group;
+struct Mesh;
+struct Light;
+struct Marker;
+
+using Scene_Storage =
+  cpioo::managed_entity::variant_storage<Group, Mesh, Light, Marker>;
+using Scene_Ref =
+  Scene_Storage::ref_type;
+
+struct Group {
+  int id;
+  std::optional<Scene_Ref> first;
+  std::optional<Scene_Ref> second;
+};
+
+struct Mesh {
+  int id;
+  std::array<float, 12> vertices;
+};
+
+struct Light {
+  int id;
+  float intensity;
+};
+
+static int s_markers_alive = 0;
+
+struct Marker {
+  int id;
+
+  explicit Marker(int id) : id(id) {
+    s_markers_alive++;
+  }
+
+  ~Marker() {
+    s_markers_alive--;
+  }
+};
+
+struct IdOf {
+  int operator()(const Group& group) const {
+    int total = group.id;
+    if (group.first.has_value()) {
+      total += group.first->visit(*this);
+    }
+    if (group.second.has_value()) {
+      total += group.second->visit(*this);
+    }
+    return total;
+  }
+
+  template <class T>
+  int operator()(const T& leaf) const {
+    return leaf.id;
+  }
+};
+
+TEST(t_015_variant_storage, size_classes) {
+  // slots are powers of two from 16 bytes, the last 8 bytes (the
+  // alignment of a reference) holding the type tag
+  EXPECT_EQ(16u, sizeof(Scene_Storage::slab<0>));
+  EXPECT_EQ(32u, sizeof(Scene_Storage::slab<1>));
+  EXPECT_EQ(64u, sizeof(Scene_Storage::slab<2>));
+  EXPECT_EQ(Scene_Storage::size_class_of<Light>, Scene_Storage::size_class_of<Marker>);
+  EXPECT_EQ(2u, Scene_Storage::size_class_of<Mesh>);
+  EXPECT_EQ(3u, Scene_Storage::size_classes());
+}
+
+TEST(t_015_variant_storage, tagged_references_dispatch) {
+  auto light = Scene_Storage::make_entity<Light>(1, 0.5f);
+  auto mesh = Scene_Storage::make_entity<Mesh>(2, std::array<float, 12>{});
+  auto scene = Scene_Storage::make_entity<Group>(
+    10, std::optional<Scene_Ref>(light),
+    std::optional<Scene_Ref>(Scene_Storage::make_entity<Group>(
+      20, std::optional<Scene_Ref>(mesh), std::nullopt)));
+
+  EXPECT_TRUE(light.holds<Light>());
+  EXPECT_FALSE(light.holds<Mesh>());
+  EXPECT_EQ(Scene_Storage::type_index<Light>, light.type());
+  EXPECT_EQ(nullptr, light.get_if<Group>());
+  ASSERT_NE(nullptr, light.get_if<Light>());
+  EXPECT_EQ(0.5f, light.get_if<Light>()->intensity);
+  EXPECT_EQ(Scene_Storage::size_class_of<Mesh>, mesh.size_class());
+
+  EXPECT_EQ(33, scene.visit(IdOf()));
+  EXPECT_EQ(33, cpioo::managed_entity::visit(IdOf(), scene));
+}
+
+TEST(t_015_variant_storage, types_of_a_class_share_slots) {
+  int markers = s_markers_alive;
+  std::optional<Scene_Ref> marker(Scene_Storage::make_entity<Marker>(7));
+  EXPECT_EQ(markers + 1, s_markers_alive);
+  auto index = marker->index();
+  marker.reset();
+  // released through the type tag, so the Marker destructor ran
+  EXPECT_EQ(markers, s_markers_alive);
+
+  // a Light fits the same class and takes the freed slot
+  auto light = Scene_Storage::make_entity<Light>(3, 1.0f);
+  EXPECT_EQ(index, light.index());
+  EXPECT_EQ(3, light.visit(IdOf()));
+  EXPECT_EQ(markers, s_markers_alive);
+}